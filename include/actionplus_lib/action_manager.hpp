@@ -9,7 +9,12 @@
 #define ACTIONPLUS_LIB__ACTION_MANAGER_HPP_
 
 #include "action_metadata.hpp"
+#include "action_scores.hpp"
+#include "action_stats.hpp"
+#include "analysis_snapshot.hpp"
+#include "live_score_session.hpp"
 #include "detail/analyze_manager.hpp"
+#include "detail/executor.hpp"
 #include "detail/export_manager.hpp"
 #include "detail/import_temp_manager.hpp"
 #include "detail/storage_manager.hpp"
@@ -17,6 +22,7 @@
 
 #include <boost/filesystem.hpp>
 #include <chrono>
+#include <condition_variable>
 #include <cstddef>
 #include <cstdint>
 #include <functional>
@@ -38,6 +44,27 @@ namespace actionplus_lib
 class ActionManager
 {
 public:
+	// parallel_analyses is the number of videos analyzed at the same time. The
+	// estimator threads are split between them.
+	//
+	// With cache_frames, decoded frames are cached in the storage (about
+	// 0.7 MB per frame at 368x656) to make analyzing the same video again
+	// faster.
+	//
+	// Analyses of standard videos are kept in memory up to
+	// analysis_cache_bytes.
+	//
+	// Up to read_threads storage reads, and as many analyze reads (scores,
+	// analyses), run at the same time. With more than one, their callbacks
+	// may be called in another order than the calls were made.
+	//
+	// All tasks run on up to max_threads threads (0 for no limit), which are
+	// only started when a task could run and no thread is idle. When they
+	// are short, reads start first, then storage writes, then imports,
+	// exports and analyses, then trash cleaning. A limit below the sum of
+	// parallel_analyses, read_threads storage reads, read_threads analyze
+	// reads and the helpers of batch scoring makes tasks wait for each other
+	// across lanes.
 	inline ActionManager(const std::string &dir,
 		std::unique_ptr<std::vector<std::uint8_t>> graph,
 		std::size_t graph_height,
@@ -47,15 +74,34 @@ public:
 		std::function<void()> import_callback,
 		std::function<void()> export_callback,
 		std::function<void()> storage_read_callback,
-		std::function<void()> storage_write_callback):
+		std::function<void()> storage_write_callback,
+		std::size_t parallel_analyses = 1,
+		bool cache_frames = false,
+		std::size_t analysis_cache_bytes = 256 * 1024 * 1024,
+		std::size_t read_threads = 1,
+		std::size_t max_threads = 0):
 	root_dir(dir),
-	storage_manager(dir, storage_read_callback, storage_write_callback),
-	import_temp_manager(dir, import_callback),
-	export_manager(dir, export_callback),
-	analyze_manager(dir, std::move(graph), graph_height, graph_width,
-		analyze_read_callback, analyze_write_callback)
+	executor(max_threads),
+	storage_manager(executor, dir, storage_read_callback,
+		storage_write_callback, read_threads),
+	import_temp_manager(executor, dir, import_callback),
+	export_manager(executor, dir, export_callback),
+	analyze_manager(executor, dir, std::move(graph), graph_height, graph_width,
+		analyze_read_callback, analyze_write_callback, parallel_analyses,
+		cache_frames, analysis_cache_bytes, read_threads)
+	{
+		trash_thread = std::thread(std::bind(&ActionManager::trash_timer,
+			this));
+	}
+
+	inline ~ActionManager()
 	{
-		trash_worker.add(std::bind(&ActionManager::trash_task, this));
+		{
+			std::lock_guard<std::mutex> lk(trash_mtx);
+			trash_stop = true;
+		}
+		trash_cv.notify_all();
+		trash_thread.join();
 	}
 
 	// List all items
@@ -102,6 +148,17 @@ public:
 		analyze_manager.get_analysis(id, callback);
 	}
 
+	// Get frames [first, first + count) of an existing (finished) analysis,
+	// or fewer at its end (humans is nullptr if not analyzed)
+	inline void get_analysis_range(const std::string &id, std::size_t first,
+		std::size_t count,
+		std::function<void(std::size_t length, std::size_t first,
+			std::unique_ptr<std::list<std::unique_ptr<libaction::Human>>>
+				humans)> callback)
+	{
+		analyze_manager.get_analysis_range(id, first, count, callback);
+	}
+
 	// Get the metadata of the currently running analysis
 	inline void current_analysis_meta(
 		std::function<void(
@@ -120,6 +177,16 @@ public:
 		analyze_manager.current_analysis(callback);
 	}
 
+	// Get frames [since, end) of the currently running analysis without
+	// copying them. Pass the end() of the previous snapshot as since to only
+	// get the new frames, as long as id and generation() are unchanged.
+	inline void current_analysis_snapshot(std::size_t since,
+		std::function<void(const std::string &id, std::size_t length,
+			const AnalysisSnapshot &snapshot)> callback)
+	{
+		analyze_manager.current_analysis_snapshot(since, callback);
+	}
+
 	// Score a video against a standard video. If one of the videos is not
 	// analyzed, scored will be false.
 	//
@@ -131,6 +198,29 @@ public:
 		analyze_manager.quick_score(sample_id, standard_id, callback);
 	}
 
+	// Score a video against many standard videos in parallel. results[i] is
+	// (scored, mean) against standard_ids[i], as in quick_score().
+	inline void batch_quick_score(const std::string &sample_id,
+		const std::vector<std::string> &standard_ids,
+		std::function<void(
+			std::unique_ptr<std::vector<std::pair<bool, std::uint8_t>>>
+				results)> callback)
+	{
+		analyze_manager.batch_quick_score(sample_id, standard_ids, callback);
+	}
+
+	// Score many videos against a standard video in parallel. results[i] is
+	// (scored, mean) of sample_ids[i], as in quick_score().
+	inline void batch_quick_score_samples(
+		const std::vector<std::string> &sample_ids,
+		const std::string &standard_id,
+		std::function<void(
+			std::unique_ptr<std::vector<std::pair<bool, std::uint8_t>>>
+				results)> callback)
+	{
+		analyze_manager.batch_quick_score_samples(sample_ids, standard_id, callback);
+	}
+
 	// Score a video against a standard video. If one of the videos is not
 	// analyzed, scored will be false.
 	inline void score(const std::string &sample_id,
@@ -153,6 +243,17 @@ public:
 			missed_max_length, callback);
 	}
 
+	// Score a video against a standard video, as one row of scores per frame
+	// and one column per ScorePairs entry. If one of the videos is not
+	// analyzed, scored will be false.
+	inline void score_matrix(const std::string &sample_id,
+		const std::string &standard_id,
+		std::function<void(bool scored, std::unique_ptr<ScoreMatrix> matrix)>
+			callback)
+	{
+		analyze_manager.score_matrix(sample_id, standard_id, callback);
+	}
+
 	// Score a video during analysis. If the standard video is not analyzed,
 	// scored will be false.
 	inline void live_score(
@@ -203,7 +304,11 @@ public:
 	// Remove an item
 	inline void remove(const std::string &id)
 	{
-		storage_manager.remove(id);
+		// Forgotten again once moved, in case it is read meanwhile
+		analyze_manager.forget_analysis(id);
+		storage_manager.remove(id, [this, id] {
+			analyze_manager.forget_analysis(id);
+		});
 	}
 
 	// Analyze a video. An analyze write task will be immediately created.
@@ -214,6 +319,15 @@ public:
 		analyze_manager.analyze(id);
 	}
 
+	// Start scoring a video during analysis against a standard video. The
+	// session scores only the frames added to it. If the standard video is
+	// not analyzed, session will be nullptr.
+	inline void live_score_session(const std::string &standard_id,
+		std::function<void(std::shared_ptr<LiveScoreSession> session)> callback)
+	{
+		analyze_manager.live_score_session(standard_id, callback);
+	}
+
 	// Cancel one import task
 	inline void cancel_one_import()
 	{
@@ -232,6 +346,25 @@ public:
 		analyze_manager.cancel_one();
 	}
 
+	// Statistics of the still estimators shared by all analyses
+	inline EstimatorPoolStats estimator_pool_stats()
+	{
+		return analyze_manager.estimator_pool_stats();
+	}
+
+	// Statistics of the in-memory cache of standard analyses
+	inline AnalysisCacheStats analysis_cache_stats()
+	{
+		return analyze_manager.analysis_cache_stats();
+	}
+
+	// Video buffer statistics of the running analyses, by id
+	inline std::list<std::pair<std::string, VideoBufferStats>>
+		video_buffer_stats()
+	{
+		return analyze_manager.video_buffer_stats();
+	}
+
 	// Description of analyze read tasks (strings can be empty)
 	inline std::list<std::string> analyze_read_tasks()
 	{
@@ -271,32 +404,52 @@ public:
 private:
 	std::string root_dir;
 
+	// Runs the tasks of all the workers below
+	detail::Executor executor;
+
 	detail::StorageManager storage_manager;
 	detail::ImportTempManager import_temp_manager;
 	detail::ExportManager export_manager;
 	detail::AnalyzeManager analyze_manager;
 
-	int trash_count{16};
-	detail::Worker trash_worker{[] {}};
+	detail::Worker trash_worker{executor, detail::priority::background,
+		[] {}};
 
-	inline void trash_task()
+	// Waits between trash cleanings off the executor, so that no thread of
+	// it is held by the wait
+	std::mutex trash_mtx{};
+	std::condition_variable trash_cv{};
+	bool trash_stop{false};
+	bool trash_queued{false};
+	std::thread trash_thread{};
+
+	inline void trash_timer()
 	{
-		if (trash_count < 16) {
-			trash_count++;
-			std::this_thread::sleep_for(std::chrono::seconds(1));
-		} else {
-			trash_count = 0;
-			try {
-				for (auto &ent: boost::filesystem::directory_iterator(
-						root_dir + "/trash")) {
-					try {
-						boost::filesystem::remove_all(ent.path());
-					} catch (...) {}
-				}
-			} catch (...) {}
+		std::unique_lock<std::mutex> lk(trash_mtx);
+		while (!trash_stop) {
+			// Skip a round if the last cleaning has not run yet
+			if (!trash_queued) {
+				trash_queued = true;
+				trash_worker.add(std::bind(&ActionManager::trash_task, this));
+			}
+			trash_cv.wait_for(lk, std::chrono::seconds(17),
+				[this] { return trash_stop; });
 		}
+	}
+
+	inline void trash_task()
+	{
+		try {
+			for (auto &ent: boost::filesystem::directory_iterator(
+					root_dir + "/trash")) {
+				try {
+					boost::filesystem::remove_all(ent.path());
+				} catch (...) {}
+			}
+		} catch (...) {}
 
-		trash_worker.add(std::bind(&ActionManager::trash_task, this));
+		std::lock_guard<std::mutex> lk(trash_mtx);
+		trash_queued = false;
 	}
 };
 
@@ -0,0 +1,98 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * This Source Code Form is "Incompatible With Secondary Licenses", as
+ * defined by the Mozilla Public License, v. 2.0. */
+
+#ifndef ACTIONPLUS_LIB__ACTION_SCORES_HPP_
+#define ACTIONPLUS_LIB__ACTION_SCORES_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <libaction/body_part.hpp>
+#include <utility>
+#include <vector>
+
+namespace actionplus_lib
+{
+
+namespace detail
+{
+
+// A template only so that the table can be defined in this header
+template<typename T>
+struct ScorePairTable
+{
+	using PartIndex = libaction::BodyPart::PartIndex;
+
+	static constexpr std::size_t count = 19;
+
+	// Limbs of the COCO body model. The last two are not drawn, but may be
+	// scored too.
+	static constexpr std::pair<PartIndex, PartIndex> pairs[count] = {
+		{PartIndex::neck, PartIndex::r_shoulder},
+		{PartIndex::neck, PartIndex::l_shoulder},
+		{PartIndex::r_shoulder, PartIndex::r_elbow},
+		{PartIndex::r_elbow, PartIndex::r_wrist},
+		{PartIndex::l_shoulder, PartIndex::l_elbow},
+		{PartIndex::l_elbow, PartIndex::l_wrist},
+		{PartIndex::neck, PartIndex::r_hip},
+		{PartIndex::r_hip, PartIndex::r_knee},
+		{PartIndex::r_knee, PartIndex::r_ankle},
+		{PartIndex::neck, PartIndex::l_hip},
+		{PartIndex::l_hip, PartIndex::l_knee},
+		{PartIndex::l_knee, PartIndex::l_ankle},
+		{PartIndex::neck, PartIndex::nose},
+		{PartIndex::nose, PartIndex::r_eye},
+		{PartIndex::r_eye, PartIndex::r_ear},
+		{PartIndex::nose, PartIndex::l_eye},
+		{PartIndex::l_eye, PartIndex::l_ear},
+		{PartIndex::r_shoulder, PartIndex::r_ear},
+		{PartIndex::l_shoulder, PartIndex::l_ear}
+	};
+};
+
+template<typename T>
+constexpr std::size_t ScorePairTable<T>::count;
+
+template<typename T>
+constexpr std::pair<typename ScorePairTable<T>::PartIndex,
+	typename ScorePairTable<T>::PartIndex>
+	ScorePairTable<T>::pairs[ScorePairTable<T>::count];
+
+}
+
+// Pairs of body parts that are scored. ScorePairs::pairs[i] is column i of a
+// ScoreMatrix.
+using ScorePairs = detail::ScorePairTable<void>;
+
+// Scores of a sample video against a standard video
+struct ScoreMatrix
+{
+	std::size_t frames{};
+	// Length of a row, ScorePairs::count
+	std::size_t stride{};
+
+	// frames * stride: the score of pair p in frame f is
+	// scores[f * stride + p], if scored[f * stride + p] is 1
+	std::vector<std::uint8_t> scores{};
+	std::vector<std::uint8_t> scored{};
+
+	// Mean score of each pair over the frames it was scored in, if
+	// part_scored is 1
+	std::vector<std::uint8_t> part_means{};
+	std::vector<std::uint8_t> part_scored{};
+
+	// Mean over the frames with any score of the frame means. Unlike the
+	// other fields, it includes the pairs that are not in ScorePairs.
+	std::uint8_t mean{};
+
+	// Scores libaction returned for pairs that are not in ScorePairs, over
+	// all frames. They have no column, so score() is needed to get them.
+	std::size_t unlisted_scores{};
+};
+
+}
+
+#endif
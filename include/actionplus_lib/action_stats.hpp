@@ -0,0 +1,68 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * This Source Code Form is "Incompatible With Secondary Licenses", as
+ * defined by the Mozilla Public License, v. 2.0. */
+
+#ifndef ACTIONPLUS_LIB__ACTION_STATS_HPP_
+#define ACTIONPLUS_LIB__ACTION_STATS_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace actionplus_lib
+{
+
+struct EstimatorPoolStats
+{
+	// Estimators created so far
+	std::size_t size{};
+	// Estimators not leased right now
+	std::size_t idle{};
+	// Upper bound of size
+	std::size_t max_size{};
+
+	std::uint64_t leases{};
+	// Total and maximum time spent waiting for (and creating) estimators
+	std::uint64_t lease_wait_ns{};
+	std::uint64_t max_lease_wait_ns{};
+};
+
+struct VideoBufferStats
+{
+	// Frames decoded ahead of the readers, and its current upper bound
+	// (limited by memory)
+	std::size_t depth{};
+	std::size_t max_depth{};
+	std::size_t frame_bytes{};
+	// Frames decoded and not released by the readers yet
+	std::size_t buffered_frames{};
+
+	// Times a reader waited for a frame, and the total time spent
+	std::uint64_t reader_stalls{};
+	std::uint64_t reader_wait_ns{};
+	// Times the decoder waited because it was far enough ahead
+	std::uint64_t decoder_stalls{};
+	std::uint64_t decoder_wait_ns{};
+
+	// Times the buffer lock was contended
+	std::uint64_t lock_contentions{};
+};
+
+struct AnalysisCacheStats
+{
+	// Analyses cached, and their approximate size
+	std::size_t entries{};
+	std::size_t bytes{};
+	std::size_t max_bytes{};
+
+	std::uint64_t hits{};
+	// Including entries found out of date
+	std::uint64_t misses{};
+	std::uint64_t evictions{};
+};
+
+}
+
+#endif
@@ -0,0 +1,78 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * This Source Code Form is "Incompatible With Secondary Licenses", as
+ * defined by the Mozilla Public License, v. 2.0. */
+
+#ifndef ACTIONPLUS_LIB__ANALYSIS_SNAPSHOT_HPP_
+#define ACTIONPLUS_LIB__ANALYSIS_SNAPSHOT_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <libaction/human.hpp>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+namespace actionplus_lib
+{
+
+// Frames [begin(), end()) of a running analysis, as they were when the
+// snapshot was taken. The frames are shared with the analysis record and
+// never change, so a snapshot can be read from any thread without copying
+// or locking.
+class AnalysisSnapshot
+{
+public:
+	// Frames are stored in chunks of chunk_size
+	using Chunk = std::vector<std::shared_ptr<const libaction::Human>>;
+	using ChunkList = std::vector<std::shared_ptr<const Chunk>>;
+
+	static constexpr std::size_t chunk_size = 256;
+
+	inline AnalysisSnapshot() = default;
+
+	inline AnalysisSnapshot(std::shared_ptr<const ChunkList> chunk_list,
+		std::size_t begin_frame, std::size_t end_frame,
+		std::uint64_t record_generation) :
+	chunks(std::move(chunk_list)), first(begin_frame), last(end_frame),
+	gen(record_generation)
+	{}
+
+	inline std::size_t begin() const
+	{
+		return first;
+	}
+
+	inline std::size_t end() const
+	{
+		return last;
+	}
+
+	// Changes when the analysis restarts from frame 0. Frames from a snapshot
+	// of another generation must be discarded.
+	inline std::uint64_t generation() const
+	{
+		return gen;
+	}
+
+	// The human in frame, or nullptr if there is none
+	inline const libaction::Human *human(std::size_t frame) const
+	{
+		if (frame < first || frame >= last)
+			throw std::out_of_range("frame out of snapshot");
+
+		return (*(*chunks)[frame / chunk_size])[frame % chunk_size].get();
+	}
+
+private:
+	std::shared_ptr<const ChunkList> chunks{};
+	std::size_t first{0};
+	std::size_t last{0};
+	std::uint64_t gen{0};
+};
+
+}
+
+#endif
@@ -0,0 +1,209 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * This Source Code Form is "Incompatible With Secondary Licenses", as
+ * defined by the Mozilla Public License, v. 2.0. */
+
+#ifndef ACTIONPLUS_LIB__DETAIL__ACTION_CODEC_HPP_
+#define ACTIONPLUS_LIB__DETAIL__ACTION_CODEC_HPP_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <libaction/body_part.hpp>
+#include <libaction/human.hpp>
+#include <list>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace actionplus_lib
+{
+namespace detail
+{
+
+// Humans of each frame, as analyzed by libaction
+using ActionFrames = std::list<std::unordered_map<std::size_t,
+	libaction::Human>>;
+
+// Lossless compression of the frames of an analysis. Joints move little
+// between frames, so every value is stored as the difference of its float
+// bits to those of the same part of the same human when last seen, which is
+// small for small moves.
+//
+// This only makes action.act smaller. Scoring reads poses.bin, which is
+// written next to it uncompressed so that it can be mapped, and decoding is
+// about as fast as libaction's deserializer since both mostly build
+// libaction::Human objects.
+//
+// Layout, with all integers as LEB128 varints:
+//   frames
+//   per frame: humans
+//     per human: id, mask of its parts (bit p for part p)
+//       per part in the mask, lowest first: x, y, score, each as the
+//       zigzag encoded difference of the float bits
+namespace action_codec
+{
+
+// Parts that fit in the mask
+const std::size_t max_parts = 32;
+
+// Float bits of x, y and score of every part of a human when last seen
+using History = std::unordered_map<std::size_t,
+	std::array<std::uint32_t, max_parts * 3>>;
+
+inline void put_varint(std::vector<std::uint8_t> &out, std::uint64_t value)
+{
+	while (value >= 0x80) {
+		out.push_back(static_cast<std::uint8_t>(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back(static_cast<std::uint8_t>(value));
+}
+
+inline std::uint64_t get_varint(const std::uint8_t *&src,
+	const std::uint8_t *end)
+{
+	std::uint64_t value = 0;
+	for (unsigned int shift = 0; shift < 64; shift += 7) {
+		if (src == end)
+			throw std::runtime_error("truncated payload");
+		std::uint8_t byte = *src++;
+		value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+			return value;
+	}
+	throw std::runtime_error("invalid payload");
+}
+
+inline void put_value(std::vector<std::uint8_t> &out, std::uint32_t &last,
+	float value)
+{
+	std::uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+
+	std::uint32_t delta = bits - last;
+	put_varint(out, (delta << 1) ^ (0u - (delta >> 31)));
+	last = bits;
+}
+
+inline float get_value(const std::uint8_t *&src, const std::uint8_t *end,
+	std::uint32_t &last)
+{
+	auto zigzag = get_varint(src, end);
+	if (zigzag > 0xffffffff)
+		throw std::runtime_error("invalid payload");
+
+	auto delta = static_cast<std::uint32_t>(zigzag);
+	last += (delta >> 1) ^ (0u - (delta & 1));
+
+	float value;
+	std::memcpy(&value, &last, sizeof(value));
+	return value;
+}
+
+// Throws if a part index does not fit in the mask
+inline std::unique_ptr<std::vector<std::uint8_t>> encode(
+	const ActionFrames &action)
+{
+	auto out = std::unique_ptr<std::vector<std::uint8_t>>(
+		new std::vector<std::uint8_t>());
+	History history;
+
+	put_varint(*out, action.size());
+	for (auto &frame: action) {
+		put_varint(*out, frame.size());
+
+		for (auto &human: frame) {
+			const libaction::BodyPart *parts[max_parts]{};
+			std::uint32_t mask = 0;
+			for (auto &part: human.second.body_parts()) {
+				auto index = static_cast<std::size_t>(part.first);
+				if (index >= max_parts)
+					throw std::runtime_error("unknown body part");
+				parts[index] = &part.second;
+				mask |= static_cast<std::uint32_t>(1) << index;
+			}
+
+			put_varint(*out, human.first);
+			put_varint(*out, mask);
+
+			auto &last = history[human.first];
+			for (std::size_t i = 0; i < max_parts; i++) {
+				if (!parts[i])
+					continue;
+				put_value(*out, last[i * 3], parts[i]->x());
+				put_value(*out, last[i * 3 + 1], parts[i]->y());
+				put_value(*out, last[i * 3 + 2], parts[i]->score());
+			}
+		}
+	}
+
+	return out;
+}
+
+inline std::unique_ptr<ActionFrames> decode(
+	const std::vector<std::uint8_t> &data)
+{
+	using PartIndex = libaction::BodyPart::PartIndex;
+
+	auto action = std::unique_ptr<ActionFrames>(new ActionFrames());
+	History history;
+
+	const std::uint8_t *src = data.data();
+	const std::uint8_t *end = src + data.size();
+
+	// Every frame and human takes at least a byte, which bounds the counts
+	// of a corrupted payload
+	auto frames = get_varint(src, end);
+	if (frames > static_cast<std::uint64_t>(end - src))
+		throw std::runtime_error("invalid payload");
+
+	for (std::uint64_t f = 0; f < frames; f++) {
+		action->emplace_back();
+		auto &frame = action->back();
+
+		auto humans = get_varint(src, end);
+		if (humans > static_cast<std::uint64_t>(end - src))
+			throw std::runtime_error("invalid payload");
+
+		for (std::uint64_t h = 0; h < humans; h++) {
+			auto id = get_varint(src, end);
+			auto mask = get_varint(src, end);
+			if (id > SIZE_MAX || mask > 0xffffffff)
+				throw std::runtime_error("invalid payload");
+
+			auto &last = history[static_cast<std::size_t>(id)];
+			std::unordered_map<PartIndex, libaction::BodyPart> body_parts;
+			for (std::size_t i = 0; i < max_parts; i++) {
+				if (!(mask & (static_cast<std::uint64_t>(1) << i)))
+					continue;
+				float x = get_value(src, end, last[i * 3]);
+				float y = get_value(src, end, last[i * 3 + 1]);
+				float score = get_value(src, end, last[i * 3 + 2]);
+				auto part = static_cast<PartIndex>(i);
+				body_parts.emplace(part, libaction::BodyPart(part, x, y,
+					score));
+			}
+
+			frame.emplace(static_cast<std::size_t>(id),
+				libaction::Human(std::move(body_parts)));
+		}
+	}
+
+	if (src != end)
+		throw std::runtime_error("invalid payload");
+
+	return action;
+}
+
+}
+
+}
+}
+
+#endif
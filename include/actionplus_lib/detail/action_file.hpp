@@ -0,0 +1,587 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * This Source Code Form is "Incompatible With Secondary Licenses", as
+ * defined by the Mozilla Public License, v. 2.0. */
+
+#ifndef ACTIONPLUS_LIB__DETAIL__ACTION_FILE_HPP_
+#define ACTIONPLUS_LIB__DETAIL__ACTION_FILE_HPP_
+
+#include "action_codec.hpp"
+#include "byte_order.hpp"
+#include "file_io.hpp"
+#include "sync_file.hpp"
+
+#include <algorithm>
+#include <boost/filesystem.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <libaction/human.hpp>
+#include <libaction/motion/multi/deserialize.hpp>
+#include <libaction/motion/multi/serialize.hpp>
+#include <list>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace actionplus_lib
+{
+namespace detail
+{
+
+// Analysis of a video, as chunks of frames that are appended while the video
+// is analyzed and can be read one at a time.
+//
+// Layout (little-endian):
+//   0   magic "APACTION"
+//   8   u32 version
+//   12  u32 reserved
+//   16  u64 frames
+//   24  u64 chunks
+//   32  u64 index offset (0 until the file is complete)
+//   40  reserved up to 64
+//   then the chunks back to back, each:
+//     0   u64 first frame
+//     8   u64 frames
+//     16  u64 payload size
+//     24  u64 FNV-1a hash of the payload
+//     32  payload: the frames, encoded by action_codec (serialized by
+//         libaction in version 1)
+//   then the index, per chunk: u64 offset, u64 first frame, u64 frames,
+//   u64 payload size
+//
+// Files without the magic are whole analyses serialized by libaction, as
+// written by earlier versions.
+namespace action_file
+{
+
+const char magic[8]{'A', 'P', 'A', 'C', 'T', 'I', 'O', 'N'};
+const std::uint32_t version = 2;
+const std::uint32_t min_version = 1;
+const std::size_t header_size = 64;
+const std::size_t chunk_header_size = 32;
+const std::size_t index_entry_size = 32;
+// Frames per chunk written by an analysis
+const std::size_t chunk_frames = 256;
+const std::uint64_t max_payload_size = 0x20000000;
+
+struct Chunk
+{
+	std::uint64_t offset;
+	std::uint64_t first;
+	std::uint64_t frames;
+	std::uint64_t size;
+};
+
+inline std::uint64_t hash(const std::uint8_t *data, std::size_t size)
+{
+	std::uint64_t h = 0xcbf29ce484222325;
+	for (std::size_t i = 0; i < size; i++) {
+		h ^= data[i];
+		h *= 0x100000001b3;
+	}
+	return h;
+}
+
+inline bool read_header(FILE *f, std::uint8_t (&header)[header_size])
+{
+	return seek_file(f, 0) == 0 &&
+		std::fread(header, 1, header_size, f) == header_size &&
+		std::memcmp(header, magic, sizeof(magic)) == 0;
+}
+
+inline bool write_header(FILE *f, std::uint32_t file_version,
+	std::uint64_t frames, std::uint64_t chunks, std::uint64_t index_offset)
+{
+	std::uint8_t header[header_size]{};
+	std::memcpy(header, magic, sizeof(magic));
+	byte_order::put_u32(header + 8, file_version);
+	byte_order::put_u64(header + 16, frames);
+	byte_order::put_u64(header + 24, chunks);
+	byte_order::put_u64(header + 32, index_offset);
+
+	return seek_file(f, 0) == 0 &&
+		std::fwrite(header, 1, sizeof(header), f) == sizeof(header);
+}
+
+// Reads the chunk at offset, which must hold frames from first on and end by
+// end. False if it does not, or its payload does not match its hash.
+inline bool read_chunk(FILE *f, std::uint64_t offset, std::uint64_t end,
+	std::uint64_t first, Chunk &chunk, std::vector<std::uint8_t> &payload)
+{
+	std::uint8_t header[chunk_header_size];
+	if (end < offset || end - offset < chunk_header_size ||
+			seek_file(f, offset) != 0 ||
+			std::fread(header, 1, sizeof(header), f) < sizeof(header))
+		return false;
+
+	chunk.offset = offset;
+	chunk.first = byte_order::get_u64(header);
+	chunk.frames = byte_order::get_u64(header + 8);
+	chunk.size = byte_order::get_u64(header + 16);
+	if (chunk.first != first || chunk.frames == 0 ||
+			first > max_file_frames ||
+			chunk.frames > max_file_frames - first ||
+			chunk.size > max_payload_size ||
+			chunk.size > end - offset - chunk_header_size)
+		return false;
+
+	payload.resize(static_cast<std::size_t>(chunk.size));
+	return std::fread(payload.data(), 1, payload.size(), f) ==
+			payload.size() &&
+		hash(payload.data(), payload.size()) ==
+			byte_order::get_u64(header + 24);
+}
+
+inline std::uint64_t chunk_end(const Chunk &chunk)
+{
+	return chunk.offset + chunk_header_size + chunk.size;
+}
+
+inline bool supported(std::uint32_t file_version)
+{
+	return file_version >= min_version && file_version <= version;
+}
+
+inline std::unique_ptr<std::vector<std::uint8_t>> encode(
+	const ActionFrames &action, std::uint32_t file_version)
+{
+	if (file_version == 1)
+		return libaction::motion::multi::serialize::serialize(action);
+	return action_codec::encode(action);
+}
+
+inline std::unique_ptr<ActionFrames> decode(
+	const std::vector<std::uint8_t> &payload, std::uint64_t frames,
+	std::uint32_t file_version)
+{
+	auto result = file_version == 1 ?
+		libaction::motion::multi::deserialize::deserialize(payload) :
+		action_codec::decode(payload);
+	if (!result || result->size() != frames)
+		throw std::runtime_error("invalid chunk");
+	return result;
+}
+
+// A whole analysis written by an earlier version
+inline std::unique_ptr<ActionFrames> read_legacy(const std::string &file)
+{
+	auto result = libaction::motion::multi::deserialize::deserialize(
+		*read_file(file));
+	if (!result)
+		throw std::runtime_error("invalid analysis");
+	return result;
+}
+
+}
+
+// Writes an analysis chunk by chunk to a partial file, which is moved to its
+// final place by finish(). Every chunk is synced, so the partial file is also
+// the checkpoint of the analysis.
+class ActionWriter
+{
+public:
+	// Continues the complete chunks of partial_file, if it exists, in the
+	// version it was started with. A partial file without the magic is
+	// converted through tmp_partial_file.
+	inline ActionWriter(const std::string &partial_file,
+		const std::string &tmp_partial_file) :
+	file(partial_file)
+	{
+		std::unique_ptr<ActionFrames> legacy;
+		try {
+			if (!resume() && boost::filesystem::exists(file))
+				legacy = action_file::read_legacy(file);
+		} catch (...) {
+			close();
+			chunks.clear();
+			total = 0;
+		}
+
+		if (legacy)
+			convert(*legacy, tmp_partial_file);
+
+		if (!f)
+			create();
+	}
+
+	inline ~ActionWriter()
+	{
+		close();
+	}
+
+	ActionWriter(const ActionWriter &) = delete;
+	ActionWriter &operator=(const ActionWriter &) = delete;
+
+	inline std::size_t frames() const
+	{
+		return total;
+	}
+
+	inline std::size_t chunk_count() const
+	{
+		return chunks.size();
+	}
+
+	// Frames of a chunk that is already written
+	inline std::unique_ptr<ActionFrames> read_chunk(std::size_t i)
+	{
+		if (!f || i >= chunks.size())
+			throw std::runtime_error("chunk not found");
+
+		action_file::Chunk chunk;
+		std::vector<std::uint8_t> payload;
+		if (!action_file::read_chunk(f, chunks[i].offset, end,
+				chunks[i].first, chunk, payload))
+			throw std::runtime_error("failed to read file");
+		return action_file::decode(payload, chunk.frames, file_version);
+	}
+
+	// Drop all chunks
+	inline void clear()
+	{
+		close();
+		chunks.clear();
+		total = 0;
+		create();
+	}
+
+	// Frames [frames(), frames() + action.size())
+	inline void append(const ActionFrames &action)
+	{
+		if (action.empty())
+			return;
+		if (!f)
+			throw std::runtime_error("file closed");
+
+		auto payload = action_file::encode(action, file_version);
+		if (!payload || payload->size() > action_file::max_payload_size)
+			throw std::runtime_error("failed to encode");
+
+		action_file::Chunk chunk{end, total, action.size(), payload->size()};
+
+		std::uint8_t header[action_file::chunk_header_size];
+		byte_order::put_u64(header, chunk.first);
+		byte_order::put_u64(header + 8, chunk.frames);
+		byte_order::put_u64(header + 16, chunk.size);
+		byte_order::put_u64(header + 24,
+			action_file::hash(payload->data(), payload->size()));
+
+		if (seek_file(f, end) != 0 ||
+				std::fwrite(header, 1, sizeof(header), f) < sizeof(header) ||
+				std::fwrite(payload->data(), 1, payload->size(), f) <
+					payload->size() ||
+				std::fflush(f) != 0)
+			throw std::runtime_error("failed to write file");
+
+		sync_file(file);
+
+		chunks.push_back(chunk);
+		total += action.size();
+		end = action_file::chunk_end(chunk);
+	}
+
+	// Writes the index and moves the file to output_file
+	inline void finish(const std::string &output_file)
+	{
+		if (!f)
+			throw std::runtime_error("file closed");
+
+		std::vector<std::uint8_t> index(chunks.size() *
+			action_file::index_entry_size);
+		for (std::size_t i = 0; i < chunks.size(); i++) {
+			auto *entry = &index[i * action_file::index_entry_size];
+			byte_order::put_u64(entry, chunks[i].offset);
+			byte_order::put_u64(entry + 8, chunks[i].first);
+			byte_order::put_u64(entry + 16, chunks[i].frames);
+			byte_order::put_u64(entry + 24, chunks[i].size);
+		}
+
+		if (seek_file(f, end) != 0 ||
+				std::fwrite(index.data(), 1, index.size(), f) < index.size() ||
+				!action_file::write_header(f, file_version, total,
+					chunks.size(), end) ||
+				std::fflush(f) != 0)
+			throw std::runtime_error("failed to write file");
+
+		close();
+
+		sync_file(file);
+
+		boost::filesystem::rename(file, output_file);
+	}
+
+private:
+	const std::string file;
+
+	FILE *f{};
+	std::uint32_t file_version{action_file::version};
+	std::vector<action_file::Chunk> chunks{};
+	std::size_t total{0};
+	std::uint64_t end{action_file::header_size};
+
+	// False if there is no partial file of a supported version
+	inline bool resume()
+	{
+		f = std::fopen(file.c_str(), "r+b");
+		if (!f)
+			return false;
+
+		std::uint8_t header[action_file::header_size];
+		if (!action_file::read_header(f, header) ||
+				!action_file::supported(byte_order::get_u32(header + 8))) {
+			close();
+			return false;
+		}
+		file_version = byte_order::get_u32(header + 8);
+
+		auto size = file_size(f);
+		action_file::Chunk chunk;
+		std::vector<std::uint8_t> payload;
+		while (action_file::read_chunk(f, end, size, total, chunk, payload)) {
+			chunks.push_back(chunk);
+			total += static_cast<std::size_t>(chunk.frames);
+			end = action_file::chunk_end(chunk);
+		}
+
+		// Drop what follows, such as a chunk that was being written, or the
+		// index of a file that was not moved yet
+		if (end != size) {
+			close();
+			boost::filesystem::resize_file(file, end);
+			f = std::fopen(file.c_str(), "r+b");
+			if (!f)
+				throw std::runtime_error("failed to open file");
+		}
+
+		if (!action_file::write_header(f, file_version, 0, 0, 0) ||
+				std::fflush(f) != 0)
+			throw std::runtime_error("failed to write file");
+
+		return true;
+	}
+
+	// Writes action to tmp_file and moves it over the legacy partial file,
+	// so that a crash keeps one of them
+	inline void convert(const ActionFrames &action, const std::string &tmp_file)
+	{
+		try {
+			{
+				ActionWriter converted(tmp_file, "");
+				converted.append(action);
+			}
+			boost::filesystem::rename(tmp_file, file);
+		} catch (...) {
+			try {
+				boost::filesystem::remove(tmp_file);
+			} catch (...) {}
+			throw;
+		}
+
+		if (!resume())
+			throw std::runtime_error("failed to convert file");
+	}
+
+	inline void create()
+	{
+		f = std::fopen(file.c_str(), "w+b");
+		if (!f)
+			throw std::runtime_error("failed to open file");
+
+		file_version = action_file::version;
+		if (!action_file::write_header(f, file_version, 0, 0, 0) ||
+				std::fflush(f) != 0) {
+			close();
+			throw std::runtime_error("failed to write file");
+		}
+
+		end = action_file::header_size;
+	}
+
+	inline void close()
+	{
+		if (f) {
+			std::fclose(f);
+			f = nullptr;
+		}
+	}
+};
+
+// Reads a complete analysis chunk by chunk, or any range of its frames
+class ActionReader
+{
+public:
+	// Throws if the file is missing or invalid. A file without the magic is
+	// read as one chunk.
+	inline explicit ActionReader(const std::string &action_file) :
+	file(action_file)
+	{
+		f = std::fopen(file.c_str(), "rb");
+		if (!f)
+			throw std::runtime_error("failed to open file");
+
+		std::uint8_t header[action_file::header_size];
+		if (!action_file::read_header(f, header)) {
+			std::fclose(f);
+			f = nullptr;
+
+			legacy = action_file::read_legacy(file);
+			total = legacy->size();
+			if (total != 0)
+				chunks.push_back(action_file::Chunk{0, 0, total, 0});
+			return;
+		}
+
+		try {
+			read_index(header);
+		} catch (...) {
+			std::fclose(f);
+			throw;
+		}
+	}
+
+	inline ~ActionReader()
+	{
+		if (f)
+			std::fclose(f);
+	}
+
+	ActionReader(const ActionReader &) = delete;
+	ActionReader &operator=(const ActionReader &) = delete;
+
+	inline std::size_t frames() const
+	{
+		return total;
+	}
+
+	inline std::size_t chunk_count() const
+	{
+		return chunks.size();
+	}
+
+	inline std::unique_ptr<ActionFrames> read_chunk(std::size_t i)
+	{
+		if (i >= chunks.size())
+			throw std::runtime_error("chunk not found");
+
+		if (!f) {
+			// The legacy file is read again once given away
+			if (legacy)
+				return std::move(legacy);
+			return action_file::read_legacy(file);
+		}
+
+		action_file::Chunk chunk;
+		std::vector<std::uint8_t> payload;
+		if (!action_file::read_chunk(f, chunks[i].offset, index_offset,
+				chunks[i].first, chunk, payload) ||
+				chunk.frames != chunks[i].frames ||
+				chunk.size != chunks[i].size)
+			throw std::runtime_error("invalid chunk");
+		return action_file::decode(payload, chunk.frames, file_version);
+	}
+
+	// Frames [first, first + count), or fewer at the end. Only the chunks
+	// with these frames are read.
+	inline std::unique_ptr<ActionFrames> read(std::size_t first,
+		std::size_t count)
+	{
+		auto result = std::unique_ptr<ActionFrames>(new ActionFrames());
+		if (first >= total)
+			return result;
+		std::size_t last = first + std::min(count, total - first);
+
+		auto it = std::upper_bound(chunks.begin(), chunks.end(), first,
+			[](std::size_t frame, const action_file::Chunk &chunk) {
+				return frame < chunk.first;
+			});
+		if (it != chunks.begin())
+			it--;
+
+		for (; it != chunks.end() && it->first < last; it++) {
+			auto frames = read_chunk(static_cast<std::size_t>(
+				it - chunks.begin()));
+
+			auto chunk_first = static_cast<std::size_t>(it->first);
+			auto begin = frames->begin();
+			std::advance(begin, std::max(first, chunk_first) - chunk_first);
+			auto end = begin;
+			std::advance(end, std::min(last, static_cast<std::size_t>(
+				chunk_first + it->frames)) - std::max(first, chunk_first));
+
+			result->splice(result->end(), *frames, begin, end);
+		}
+
+		return result;
+	}
+
+private:
+	const std::string file;
+
+	// nullptr for a legacy file
+	FILE *f{};
+	std::uint32_t file_version{0};
+	std::unique_ptr<ActionFrames> legacy{};
+
+	std::vector<action_file::Chunk> chunks{};
+	std::size_t total{0};
+	std::uint64_t index_offset{0};
+
+	inline void read_index(const std::uint8_t *header)
+	{
+		auto size = file_size(f);
+		auto frames = byte_order::get_u64(header + 16);
+		auto count = byte_order::get_u64(header + 24);
+		index_offset = byte_order::get_u64(header + 32);
+		file_version = byte_order::get_u32(header + 8);
+
+		if (!action_file::supported(file_version) ||
+				frames > max_file_frames || count > frames ||
+				index_offset < action_file::header_size ||
+				index_offset > size ||
+				count > (size - index_offset) / action_file::index_entry_size)
+			throw std::runtime_error("invalid analysis");
+
+		std::vector<std::uint8_t> index(static_cast<std::size_t>(count) *
+			action_file::index_entry_size);
+		if (seek_file(f, index_offset) != 0 ||
+				std::fread(index.data(), 1, index.size(), f) < index.size())
+			throw std::runtime_error("failed to read file");
+
+		std::uint64_t next_offset = action_file::header_size;
+		std::uint64_t next_first = 0;
+		for (std::size_t i = 0; i < count; i++) {
+			auto *entry = &index[i * action_file::index_entry_size];
+			action_file::Chunk chunk{byte_order::get_u64(entry),
+				byte_order::get_u64(entry + 8), byte_order::get_u64(entry + 16),
+				byte_order::get_u64(entry + 24)};
+
+			if (chunk.offset != next_offset || chunk.first != next_first ||
+					chunk.frames == 0 || chunk.frames > frames - next_first ||
+					index_offset - chunk.offset <
+						action_file::chunk_header_size ||
+					chunk.size > index_offset - chunk.offset -
+						action_file::chunk_header_size)
+				throw std::runtime_error("invalid analysis");
+
+			chunks.push_back(chunk);
+			next_offset = action_file::chunk_end(chunk);
+			next_first += chunk.frames;
+		}
+
+		if (next_first != frames)
+			throw std::runtime_error("invalid analysis");
+		total = static_cast<std::size_t>(frames);
+	}
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,180 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * This Source Code Form is "Incompatible With Secondary Licenses", as
+ * defined by the Mozilla Public License, v. 2.0. */
+
+#ifndef ACTIONPLUS_LIB__DETAIL__ANALYSIS_CACHE_HPP_
+#define ACTIONPLUS_LIB__DETAIL__ANALYSIS_CACHE_HPP_
+
+#include "../action_stats.hpp"
+#include "file_io.hpp"
+#include "pose_track.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace actionplus_lib
+{
+namespace detail
+{
+
+// Loaded analyses, least recently used first out once they take more than
+// max_bytes. An entry is only returned for the same FileStamp of the
+// analysis file it was loaded from.
+//
+// Modification times may only be precise to the second, so whoever rewrites
+// or removes an analysis file also calls invalidate() afterwards. An analysis
+// loaded before that is not put back, as put() takes the generation() from
+// before loading.
+class AnalysisCache
+{
+public:
+	inline AnalysisCache(std::size_t max_bytes) :
+	max_size(max_bytes)
+	{}
+
+	AnalysisCache(const AnalysisCache &) = delete;
+	AnalysisCache &operator=(const AnalysisCache &) = delete;
+
+	// nullptr if not cached
+	inline std::shared_ptr<const PoseTrack> get(const std::string &id,
+		const FileStamp &stamp)
+	{
+		std::shared_ptr<const PoseTrack> stale;
+		std::lock_guard<std::mutex> lk(mtx);
+
+		auto it = index.find(id);
+		if (it == index.end()) {
+			misses++;
+			return nullptr;
+		}
+
+		if (it->second->stamp != stamp) {
+			misses++;
+			stale = erase(it);
+			return nullptr;
+		}
+
+		hits++;
+		entries.splice(entries.begin(), entries, it->second);
+		return it->second->action;
+	}
+
+	// Changes on every invalidate()
+	inline std::uint64_t generation()
+	{
+		std::lock_guard<std::mutex> lk(mtx);
+		return current_generation;
+	}
+
+	// Ignored if anything was invalidated since loaded_generation
+	inline void put(const std::string &id, std::uint64_t loaded_generation,
+		const FileStamp &stamp, std::shared_ptr<const PoseTrack> action)
+	{
+		if (!action)
+			return;
+
+		auto bytes = action->bytes();
+		if (bytes > max_size)
+			return;
+
+		// Released after the lock, since freeing an analysis takes a while
+		std::vector<std::shared_ptr<const PoseTrack>> evicted;
+
+		std::lock_guard<std::mutex> lk(mtx);
+
+		if (loaded_generation != current_generation)
+			return;
+
+		auto it = index.find(id);
+		if (it != index.end())
+			evicted.push_back(erase(it));
+
+		while (size + bytes > max_size && !entries.empty()) {
+			evicted.push_back(erase(index.find(entries.back().id)));
+			evictions++;
+		}
+
+		Entry entry;
+		entry.id = id;
+		entry.stamp = stamp;
+		entry.bytes = bytes;
+		entry.action = std::move(action);
+		entries.push_front(std::move(entry));
+		index[id] = entries.begin();
+		size += bytes;
+	}
+
+	inline void invalidate(const std::string &id)
+	{
+		std::shared_ptr<const PoseTrack> removed;
+		std::lock_guard<std::mutex> lk(mtx);
+
+		current_generation++;
+
+		auto it = index.find(id);
+		if (it != index.end())
+			removed = erase(it);
+	}
+
+	inline AnalysisCacheStats stats()
+	{
+		std::lock_guard<std::mutex> lk(mtx);
+
+		AnalysisCacheStats result;
+		result.entries = entries.size();
+		result.bytes = size;
+		result.max_bytes = max_size;
+		result.hits = hits;
+		result.misses = misses;
+		result.evictions = evictions;
+		return result;
+	}
+
+private:
+	struct Entry
+	{
+		std::string id;
+		FileStamp stamp;
+		std::size_t bytes;
+		std::shared_ptr<const PoseTrack> action;
+	};
+
+	const std::size_t max_size;
+
+	std::mutex mtx{};
+	// Most recently used first
+	std::list<Entry> entries{};
+	std::unordered_map<std::string, std::list<Entry>::iterator> index{};
+	std::size_t size{0};
+	std::uint64_t current_generation{0};
+
+	std::uint64_t hits{0};
+	std::uint64_t misses{0};
+	std::uint64_t evictions{0};
+
+	// Returns the analysis of the entry, to be released by the caller
+	inline std::shared_ptr<const PoseTrack> erase(
+		std::unordered_map<std::string, std::list<Entry>::iterator>::iterator it)
+	{
+		auto action = std::move(it->second->action);
+		size -= it->second->bytes;
+		entries.erase(it->second);
+		index.erase(it);
+		return action;
+	}
+};
+
+}
+}
+
+#endif
@@ -8,27 +8,41 @@
 #ifndef ACTIONPLUS_LIB__DETAIL__ANALYZE_HELPER_HPP_
 #define ACTIONPLUS_LIB__DETAIL__ANALYZE_HELPER_HPP_
 
-#include "sync_file.hpp"
+#include "../action_scores.hpp"
+#include "../action_stats.hpp"
+#include "../live_score_session.hpp"
+#include "action_file.hpp"
+#include "analysis_cache.hpp"
+#include "core_budget.hpp"
+#include "estimator_pool.hpp"
+#include "file_io.hpp"
+#include "parallel_for.hpp"
+#include "pose_file.hpp"
+#include "pose_track.hpp"
+#include "score_matrix.hpp"
 #include "video_analyzer.hpp"
 #include "worker.hpp"
 
 #include <algorithm>
+#include <array>
 #include <atomic>
 #include <boost/filesystem.hpp>
 #include <boost/uuid/uuid.hpp>
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/uuid/uuid_io.hpp>
+#include <chrono>
+#include <condition_variable>
 #include <cstddef>
 #include <cstdint>
 #include <functional>
 #include <libaction/body_part.hpp>
 #include <libaction/human.hpp>
-#include <libaction/motion/multi/deserialize.hpp>
-#include <libaction/motion/multi/serialize.hpp>
 #include <libaction/motion/single/missed_moves.hpp>
 #include <libaction/still/single/score.hpp>
 #include <list>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <string>
 #include <utility>
@@ -42,70 +56,169 @@ namespace detail
 class AnalyzeHelper
 {
 public:
-	inline AnalyzeHelper(const std::string &dir,
+	inline AnalyzeHelper(Executor &executor, const std::string &dir,
 		std::unique_ptr<std::vector<std::uint8_t>> graph,
 		std::size_t graph_height, std::size_t graph_width,
 		std::function<void()> read_callback,
-		std::function<void()> write_callback) :
+		std::function<void()> write_callback,
+		std::size_t parallel_analyses = 1, bool cache_frames = false,
+		std::size_t analysis_cache_bytes = 256 * 1024 * 1024,
+		std::size_t read_threads = 1) :
 	storage_dir(dir + "/storage"), tmp_dir(dir + "/tmp"),
+	use_frame_cache(cache_frames),
+	analysis_cache(analysis_cache_bytes),
+	score_threads(std::max(VideoAnalyzer::default_estimators() /
+		std::max(read_threads, static_cast<std::size_t>(1)),
+		static_cast<std::size_t>(1))),
 	graph_data(std::move(graph)), height(graph_height), width(graph_width),
-	write_worker(write_callback),
-	read_worker(read_callback)
+	core_budget(VideoAnalyzer::default_estimators()),
+	estimator_pool(*graph_data, height, width, core_budget.cores()),
+	write_worker(executor, priority::bulk, write_callback, parallel_analyses),
+	read_worker(executor, priority::read, read_callback, read_threads),
+	// The reading thread itself is one of the score_threads
+	score_worker(executor, priority::read_helper, [] {},
+		std::max(score_threads - 1, static_cast<std::size_t>(1)))
 	{}
 
 	// Analyze a video. An analyze write task will be immediately created.
 	// It's better to check is_analyzed() and write_tasks() before adding a
 	// task here.
+	//
+	// Up to parallel_analyses videos are analyzed at the same time, sharing
+	// the estimator threads.
+	//
+	// Analyzed frames are appended to the partial analysis file in chunks,
+	// at least every checkpoint_interval and when the analysis is canceled.
+	// Only the current chunk is kept in memory. A later analysis of the same
+	// video resumes after the last complete chunk.
+	//
+	// With cache_frames, the decoded frames are kept in the storage so that
+	// analyzing the video again (after being canceled, or with a new graph of
+	// the same size) does not decode it again.
+	//
+	// progress receives the newly analyzed frames [start, start +
+	// humans->size()) of the length frames. Frames restored from a checkpoint
+	// are reported together, at start 0. If progress returns false, for
+	// missing the frames before start, all frames so far are reported again
+	// at start 0.
 	inline void analyze(const std::string &id,
-		std::function<void(std::size_t length,
+		std::function<bool(std::size_t length, std::size_t start,
 			std::unique_ptr<std::list<std::unique_ptr<libaction::Human>>>
 				humans)> progress,
 		std::function<void()> done)
 	{
 		write_worker.add([this, id, progress, done] {
+			// Already analyzed. Checked before the job is listed, so that
+			// nothing is left to clean up.
 			try {
-				canceled = false;
-
 				if (boost::filesystem::exists(storage_dir + "/" + id +
 						"/action.act")) {
-					// Already analyzed
 					try {
 						done();
 					} catch (...) {}
 					return;
 				}
+			} catch (...) {}
 
+			RunningJob job(*this, id);
+
+			// Another analysis of the same video is running, and would share
+			// action.partial with this one
+			if (!job.exclusive())
+				return;
+
+			try {
 				std::string video = get_video_file(id);
 				std::string output = storage_dir + "/" + id + "/action.act";
+				std::string checkpoint = storage_dir + "/" + id +
+					"/action.partial";
+
+				std::string cache_file, tmp_cache_file;
+				if (use_frame_cache) {
+					cache_file = storage_dir + "/" + id + "/frames.cache";
+					tmp_cache_file = tmp_dir + "/" + new_uuid();
+				}
+
+				ActionWriter writer(checkpoint, tmp_dir + "/" + new_uuid());
+
+				auto *analyzer = &job.start(std::unique_ptr<VideoAnalyzer>(
+					new VideoAnalyzer(video, height, width, estimator_pool,
+						core_budget, writer.frames(), cache_file,
+						tmp_cache_file)));
+
+				if (writer.frames() > analyzer->frames()) {
+					// Broken checkpoint
+					writer.clear();
+					if (use_frame_cache)
+						tmp_cache_file = tmp_dir + "/" + new_uuid();
+					analyzer = &job.start(std::unique_ptr<VideoAnalyzer>(
+						new VideoAnalyzer(video, height, width, estimator_pool,
+							core_budget, 0, cache_file, tmp_cache_file)));
+				}
 
-				VideoAnalyzer analyzer(video, *graph_data, height, width);
+				// Frames after the written chunks
+				ActionFrames action;
+
+				// Reports the written chunks and action at start 0
+				auto report_all = [this, &writer, &action, &analyzer,
+						&progress] {
+					auto humans = std::unique_ptr<std::list<
+						std::unique_ptr<libaction::Human>>>(
+							new std::list<std::unique_ptr<libaction::Human>>());
+					for (std::size_t c = 0; c < writer.chunk_count(); c++)
+						humans->splice(humans->end(),
+							*simplify_for_result(*writer.read_chunk(c)));
+					for (auto &frame: action)
+						humans->push_back(simplify_frame(frame));
+					progress(analyzer->frames(), 0, std::move(humans));
+				};
+
+				if (writer.frames() != 0) {
+					try {
+						report_all();
+					} catch (...) {}
+				}
 
-				std::list<std::unordered_map<std::size_t, libaction::Human>>
-					action;
+				auto last_checkpoint = std::chrono::steady_clock::now();
 
-				for (std::size_t i = 0; i < analyzer.frames(); i++) {
-					if (canceled)
+				for (std::size_t i = writer.frames(); i < analyzer->frames(); i++) {
+					if (job.canceled()) {
+						try {
+							writer.append(action);
+						} catch (...) {}
 						throw std::runtime_error("");
+					}
 
-					auto res = analyzer.analyze(i);
+					auto res = analyzer->analyze(i);
 					action.push_back(std::move(*res));
 
 					try {
-						progress(analyzer.frames(),
-							simplify_for_result(action));
+						auto humans = std::unique_ptr<std::list<
+							std::unique_ptr<libaction::Human>>>(
+								new std::list<std::unique_ptr<libaction::Human>>());
+						humans->push_back(simplify_frame(action.back()));
+						bool in_sync = progress(analyzer->frames(), i,
+							std::move(humans));
+						if (!in_sync)
+							report_all();
 					} catch (...) {}
-				}
-
-				std::string tmp_file = tmp_dir + "/" + boost::uuids::to_string(uuid_gen());
 
-				auto serialized = libaction::motion::multi::serialize::serialize(action);
-				write_file(tmp_file, *serialized);
+					auto now = std::chrono::steady_clock::now();
+					if (action.size() >= action_file::chunk_frames ||
+							now - last_checkpoint >= checkpoint_interval) {
+						writer.append(action);
+						action.clear();
+						last_checkpoint = now;
+					}
+				}
 
-				sync_file(tmp_file);
+				writer.append(action);
+				writer.finish(output);
+				analysis_cache.invalidate(id);
 
-				boost::filesystem::rename(tmp_file, output);
+				// Convert for scoring now, rather than on first access
 				try {
-					boost::filesystem::remove(tmp_file);
+					read_track(id, file_stamp(output));
 				} catch (...) {}
 
 				try {
@@ -116,8 +229,6 @@ public:
 					done();
 				} catch (...) {}
 			}
-
-			canceled = false;
 		}, id);
 	}
 
@@ -129,13 +240,17 @@ public:
 	{
 		read_worker.add([this, id, callback] {
 			try {
-				auto read = read_file(storage_dir + "/" + id +
-					"/action.act");
-				auto action = libaction::motion::multi::deserialize::
-					deserialize(*read);
+				ActionReader reader(storage_dir + "/" + id + "/action.act");
+
+				auto humans = std::unique_ptr<std::list<
+					std::unique_ptr<libaction::Human>>>(
+						new std::list<std::unique_ptr<libaction::Human>>());
+				for (std::size_t c = 0; c < reader.chunk_count(); c++)
+					humans->splice(humans->end(),
+						*simplify_for_result(*reader.read_chunk(c)));
 
 				try {
-					callback(simplify_for_result(*action));
+					callback(std::move(humans));
 				} catch (...) {}
 				return;
 			} catch (...) {}
@@ -144,6 +259,34 @@ public:
 		});
 	}
 
+	// Get frames [first, first + count) of an existing (finished) analysis,
+	// or fewer at its end, without reading the rest of it. humans is nullptr
+	// if the video is not analyzed.
+	inline void get_analysis_range(const std::string &id, std::size_t first,
+		std::size_t count,
+		std::function<void(std::size_t length, std::size_t first,
+			std::unique_ptr<std::list<std::unique_ptr<libaction::Human>>>
+				humans)> callback)
+	{
+		read_worker.add([this, id, first, count, callback] {
+			std::size_t length;
+			std::unique_ptr<std::list<std::unique_ptr<libaction::Human>>>
+				humans;
+			try {
+				ActionReader reader(storage_dir + "/" + id + "/action.act");
+				length = reader.frames();
+				humans = simplify_for_result(*reader.read(first, count));
+			} catch (...) {
+				callback(0, first, nullptr);
+				return;
+			}
+
+			try {
+				callback(length, first, std::move(humans));
+			} catch (...) {}
+		});
+	}
+
 	// Score a video against a standard video. If one of the videos is not
 	// analyzed, scored will be false.
 	//
@@ -154,24 +297,94 @@ public:
 	{
 		read_worker.add([this, sample_id, standard_id, callback] {
 			try {
-				auto sample_read = read_file(storage_dir + "/" + sample_id +
-					"/action.act");
-				auto sample = libaction::motion::multi::deserialize::
-					deserialize(*sample_read);
-				auto standard_read = read_file(storage_dir + "/" + standard_id +
-					"/action.act");
-				auto standard = libaction::motion::multi::deserialize::
-					deserialize(*standard_read);
-
-				do_score(*sample, *standard, false, 0, 0,
-					std::bind(callback, std::placeholders::_1,
-						std::placeholders::_4));
+				auto sample = load_track(sample_id, false);
+				auto standard = load_track(standard_id, true);
+
+				auto mean = compute_scores(*sample, *standard)->mean;
+
+				try {
+					callback(true, mean);
+				} catch (...) {}
 			} catch (...) {
 				callback(false, 0);
 			}
 		}, sample_id);
 	}
 
+	// Score a video against many standard videos, spread over
+	// score_threads threads. results[i] is (scored, mean) against
+	// standard_ids[i], as in quick_score().
+	inline void batch_quick_score(const std::string &sample_id,
+		const std::vector<std::string> &standard_ids,
+		std::function<void(
+			std::unique_ptr<std::vector<std::pair<bool, std::uint8_t>>>
+				results)> callback)
+	{
+		read_worker.add([this, sample_id, standard_ids, callback] {
+			auto results = new_batch_results(standard_ids.size());
+
+			std::shared_ptr<const PoseTrack> sample;
+			try {
+				// Scored against every standard
+				sample = load_track(sample_id, false, true);
+			} catch (...) {}
+
+			if (sample) {
+				parallel_for(score_worker, score_threads - 1,
+						standard_ids.size(),
+						[this, &sample, &standard_ids, &results]
+						(std::size_t i) {
+					try {
+						auto standard = load_track(standard_ids[i], true);
+						(*results)[i] = std::make_pair(true,
+							compute_scores(*sample, *standard)->mean);
+					} catch (...) {}
+				});
+			}
+
+			try {
+				callback(std::move(results));
+			} catch (...) {}
+		}, sample_id);
+	}
+
+	// Score many videos against a standard video, spread over score_threads
+	// threads. results[i] is (scored, mean) of sample_ids[i], as in
+	// quick_score().
+	inline void batch_quick_score_samples(
+		const std::vector<std::string> &sample_ids,
+		const std::string &standard_id,
+		std::function<void(
+			std::unique_ptr<std::vector<std::pair<bool, std::uint8_t>>>
+				results)> callback)
+	{
+		read_worker.add([this, sample_ids, standard_id, callback] {
+			auto results = new_batch_results(sample_ids.size());
+
+			std::shared_ptr<const PoseTrack> standard;
+			try {
+				standard = load_track(standard_id, true);
+			} catch (...) {}
+
+			if (standard) {
+				parallel_for(score_worker, score_threads - 1,
+						sample_ids.size(),
+						[this, &standard, &sample_ids, &results]
+						(std::size_t i) {
+					try {
+						auto sample = load_track(sample_ids[i], false);
+						(*results)[i] = std::make_pair(true,
+							compute_scores(*sample, *standard)->mean);
+					} catch (...) {}
+				});
+			}
+
+			try {
+				callback(std::move(results));
+			} catch (...) {}
+		}, standard_id);
+	}
+
 	// Score a video against a standard video. If one of the videos is not
 	// analyzed, scored will be false.
 	inline void score(const std::string &sample_id,
@@ -193,14 +406,8 @@ public:
 		read_worker.add([this, sample_id, standard_id, missed_threshold,
 				missed_max_length, callback] {
 			try {
-				auto sample_read = read_file(storage_dir + "/" + sample_id +
-					"/action.act");
-				auto sample = libaction::motion::multi::deserialize::
-					deserialize(*sample_read);
-				auto standard_read = read_file(storage_dir + "/" + standard_id +
-					"/action.act");
-				auto standard = libaction::motion::multi::deserialize::
-					deserialize(*standard_read);
+				auto sample = load_track(sample_id, false);
+				auto standard = load_track(standard_id, true);
 
 				do_score(*sample, *standard, true, missed_threshold,
 					missed_max_length, callback);
@@ -210,6 +417,32 @@ public:
 		}, sample_id);
 	}
 
+	// Score a video against a standard video, as one row of scores per frame
+	// and one column per ScorePairs entry. If one of the videos is not
+	// analyzed, scored will be false.
+	inline void score_matrix(const std::string &sample_id,
+		const std::string &standard_id,
+		std::function<void(bool scored, std::unique_ptr<ScoreMatrix> matrix)>
+			callback)
+	{
+		read_worker.add([this, sample_id, standard_id, callback] {
+			std::unique_ptr<ScoreMatrix> matrix;
+			try {
+				auto sample = load_track(sample_id, false);
+				auto standard = load_track(standard_id, true);
+
+				matrix = compute_scores(*sample, *standard);
+			} catch (...) {
+				callback(false, nullptr);
+				return;
+			}
+
+			try {
+				callback(true, std::move(matrix));
+			} catch (...) {}
+		}, sample_id);
+	}
+
 	// Score a video during analysis. If the standard video is not analyzed,
 	// scored will be false.
 	inline void live_score(
@@ -233,22 +466,11 @@ public:
 				if (!sample2)
 					throw std::runtime_error("");
 
-				std::list<std::unordered_map<std::size_t, libaction::Human>>
-					sample_map;
-				for (auto &item: *sample2) {
-					if (item) {
-						sample_map.push_back({std::make_pair(0, std::move(*item))});
-					} else {
-						sample_map.push_back(std::unordered_map<std::size_t, libaction::Human>());
-					}
-				}
+				PoseTrack sample_track(*sample2);
 
-				auto standard_read = read_file(storage_dir + "/" + standard_id +
-					"/action.act");
-				auto standard = libaction::motion::multi::deserialize::
-					deserialize(*standard_read);
+				auto standard = load_track(standard_id, true);
 
-				do_score(sample_map, *standard, false, 0, 0,
+				do_score(sample_track, *standard, false, 0, 0,
 					std::bind(callback,
 						std::placeholders::_1, std::placeholders::_2,
 						std::placeholders::_3, std::placeholders::_4));
@@ -258,9 +480,67 @@ public:
 		}, sample_id);
 	}
 
+	// Start scoring a video during analysis against a standard video. The
+	// session scores only the frames added to it. If the standard video is
+	// not analyzed, session will be nullptr.
+	inline void live_score_session(const std::string &standard_id,
+		std::function<void(std::shared_ptr<LiveScoreSession> session)> callback)
+	{
+		read_worker.add([this, standard_id, callback] {
+			std::shared_ptr<LiveScoreSession> session;
+			try {
+				session = std::make_shared<LiveScoreSession>(
+					load_track(standard_id, true));
+			} catch (...) {}
+
+			try {
+				callback(std::move(session));
+			} catch (...) {}
+		}, standard_id);
+	}
+
+	// Cancel the earliest started analysis that is not yet canceled
 	inline void cancel_one()
 	{
-		canceled = true;
+		std::lock_guard<std::mutex> lk(jobs_mtx);
+		for (auto &job: running_jobs) {
+			if (!job->canceled) {
+				job->canceled = true;
+				break;
+			}
+		}
+	}
+
+	inline EstimatorPoolStats estimator_pool_stats()
+	{
+		return estimator_pool.stats();
+	}
+
+	inline AnalysisCacheStats analysis_cache_stats()
+	{
+		return analysis_cache.stats();
+	}
+
+	// Drop the cached analysis of a removed item
+	inline void forget_analysis(const std::string &id)
+	{
+		analysis_cache.invalidate(id);
+	}
+
+	// Video buffer statistics of the running analyses, by id
+	inline std::list<std::pair<std::string, VideoBufferStats>>
+		video_buffer_stats()
+	{
+		std::list<std::pair<std::string, VideoBufferStats>> list;
+
+		std::lock_guard<std::mutex> lk(jobs_mtx);
+		for (auto &job: running_jobs) {
+			if (job->analyzer)
+				list.push_back(std::make_pair(job->id,
+					job->analyzer->buffer_stats()));
+		}
+
+		return list;
 	}
 
 	inline std::list<std::string> read_tasks()
@@ -281,62 +561,184 @@ public:
 private:
 	std::string storage_dir;
 	std::string tmp_dir;
+	const bool use_frame_cache;
+
+	// Standard videos, which are scored against again and again
+	AnalysisCache analysis_cache;
+
+	// Threads for batch scoring, split between the reads that may run at the
+	// same time. Helpers are tasks of score_worker of one item each, so reads
+	// start before the next item when the executor is short of threads.
+	const std::size_t score_threads;
+
+	const std::chrono::seconds checkpoint_interval{60};
 
 	std::unique_ptr<std::vector<std::uint8_t>> graph_data;
 	std::size_t height;
 	std::size_t width;
 
-	std::atomic_bool canceled{false};
+	CoreBudget core_budget;
+	EstimatorPool estimator_pool;
+
+	struct Job
+	{
+		std::string id{};
+		std::atomic_bool canceled{false};
+		// Set once the video is opened. Guarded by jobs_mtx.
+		std::unique_ptr<VideoAnalyzer> analyzer{};
+	};
+
+	// Lists a job in running_jobs for its lifetime
+	class RunningJob
+	{
+	public:
+		inline RunningJob(AnalyzeHelper &analyze_helper, const std::string &id) :
+		helper(analyze_helper), job(std::make_shared<Job>())
+		{
+			job->id = id;
+
+			std::lock_guard<std::mutex> lk(helper.jobs_mtx);
+			helper.running_jobs.push_back(job);
+		}
+
+		inline ~RunningJob()
+		{
+			std::unique_ptr<VideoAnalyzer> analyzer;
+
+			{
+				std::lock_guard<std::mutex> lk(helper.jobs_mtx);
+				helper.running_jobs.remove(job);
+				analyzer = std::move(job->analyzer);
+			}
+			helper.jobs_cv.notify_all();
+
+			// Destroyed here, without holding jobs_mtx
+		}
+
+		RunningJob(const RunningJob &) = delete;
+		RunningJob &operator=(const RunningJob &) = delete;
+
+		// Replaces the analyzer of a previous start()
+		inline VideoAnalyzer &start(std::unique_ptr<VideoAnalyzer> analyzer)
+		{
+			std::lock_guard<std::mutex> lk(helper.jobs_mtx);
+			std::swap(job->analyzer, analyzer);
+			// The previous one is destroyed after jobs_mtx is released
+			return *job->analyzer;
+		}
+
+		inline bool canceled() const
+		{
+			return job->canceled;
+		}
 
+		// Waits for canceled analyses of the same video to end. False if one
+		// that is not canceled is running, which then finishes the video.
+		inline bool exclusive()
+		{
+			std::unique_lock<std::mutex> lk(helper.jobs_mtx);
+			bool running = false;
+			helper.jobs_cv.wait(lk, [this, &running] {
+				for (auto &other: helper.running_jobs) {
+					if (other == job)
+						break;
+					if (other->id != job->id)
+						continue;
+					if (!other->canceled) {
+						running = true;
+						return true;
+					}
+					return false;
+				}
+				return true;
+			});
+			return !running;
+		}
+
+	private:
+		AnalyzeHelper &helper;
+		std::shared_ptr<Job> job;
+	};
+
+	// Running analyses, in starting order
+	std::mutex jobs_mtx{};
+	std::condition_variable jobs_cv{};
+	std::list<std::shared_ptr<Job>> running_jobs{};
+
+	// Guarded by jobs_mtx
 	boost::uuids::random_generator uuid_gen{};
 
 	Worker write_worker;
 	Worker read_worker;
+	Worker score_worker;
 
-	static inline std::unique_ptr<std::vector<std::uint8_t>> read_file(
-		const std::string &file)
+	// Pose track of id. Standards are cached, while samples are only scored
+	// once in a while and would just evict them. Cached tracks, and those
+	// loaded with keep_humans, keep their humans for scoring.
+	inline std::shared_ptr<const PoseTrack> load_track(const std::string &id,
+		bool cache, bool keep_humans = false)
 	{
-		constexpr std::size_t max = 0x20000000;
-
-		FILE *f = std::fopen(file.c_str(), "rb");
-		if (!f)
-			throw std::runtime_error("failed to open file");
-
-		auto data = std::unique_ptr<std::vector<std::uint8_t>>(
-			new std::vector<std::uint8_t>());
-
-		int c;
-		while (data->size() < max && (c = std::fgetc(f)) != EOF) {
-			if (std::ferror(f)) {
-				std::fclose(f);
-				throw std::runtime_error("failed to read file");
-			}
-			data->push_back(static_cast<std::uint8_t>(c));
+		std::string file = storage_dir + "/" + id + "/action.act";
+
+		auto generation = analysis_cache.generation();
+		auto stamp = file_stamp(file);
+		if (cache) {
+			auto cached = analysis_cache.get(id, stamp);
+			if (cached)
+				return cached;
 		}
 
-		std::fclose(f);
+		auto track = read_track(id, stamp);
+		if (cache || keep_humans)
+			track->keep_humans();
+
+		if (cache)
+			analysis_cache.put(id, generation, stamp, track);
 
-		return data;
+		return track;
 	}
 
-	static inline void write_file(const std::string &file,
-		const std::vector<std::uint8_t> &data)
+	// From the pose file of id, which is converted from action.act first if
+	// it is missing or outdated
+	inline std::shared_ptr<PoseTrack> read_track(const std::string &id,
+		const FileStamp &stamp)
 	{
-		FILE *f = std::fopen(file.c_str(), "wb");
-		if (!f)
-			throw std::runtime_error("failed to open file");
+		std::string poses = storage_dir + "/" + id + "/poses.bin";
 
-		if (std::fwrite(data.data(), 1, data.size(), f) < data.size()) {
-			std::fclose(f);
-			try {
-				boost::filesystem::remove(file);
-			} catch (...) {}
-			throw std::runtime_error("failed to write file");
-		}
+		try {
+			return map_pose_file(poses, stamp);
+		} catch (...) {}
+
+		// Read chunk by chunk, so that the whole analysis is never in memory
+		// besides the track
+		ActionReader reader(storage_dir + "/" + id + "/action.act");
+		std::shared_ptr<PoseTrack> track(new PoseTrack());
+		track->reserve(reader.frames());
+		for (std::size_t c = 0; c < reader.chunk_count(); c++)
+			track->append(*reader.read_chunk(c));
+
+		// Then scored from the mapped file like later loads
+		try {
+			write_pose_file(poses, tmp_dir + "/" + new_uuid(), *track, stamp);
+			return map_pose_file(poses, stamp);
+		} catch (...) {}
 
-		std::fclose(f);
+		return track;
 	}
 
+	static inline std::unique_ptr<std::vector<std::pair<bool, std::uint8_t>>>
+		new_batch_results(std::size_t count)
+	{
+		return std::unique_ptr<std::vector<std::pair<bool, std::uint8_t>>>(
+			new std::vector<std::pair<bool, std::uint8_t>>(count,
+				std::make_pair(false, static_cast<std::uint8_t>(0))));
+	}
+
+	inline std::string new_uuid()
+	{
+		std::lock_guard<std::mutex> lk(jobs_mtx);
+		return boost::uuids::to_string(uuid_gen());
+	}
 
 	inline std::string get_video_file(const std::string &id)
 	{
@@ -357,21 +759,25 @@ private:
 	{
 		auto humans = std::unique_ptr<std::list<std::unique_ptr<libaction::Human>>>(
 			new std::list<std::unique_ptr<libaction::Human>>());
-		for (const auto &human_map: action) {
-			auto it = human_map.find(0);
-			if (it != human_map.end()) {
-				humans->push_back(std::unique_ptr<libaction::Human>(
-					new libaction::Human(it->second)));
-			} else {
-				humans->push_back(std::unique_ptr<libaction::Human>());
-			}
-		}
+		for (const auto &human_map: action)
+			humans->push_back(simplify_frame(human_map));
 
 		return humans;
 	}
 
-	template<typename Sample, typename Standard>
-	void do_score(const Sample &sample, const Standard &standard,
+	static inline std::unique_ptr<libaction::Human> simplify_frame(
+		const std::unordered_map<std::size_t, libaction::Human> &human_map)
+	{
+		auto it = human_map.find(0);
+		if (it == human_map.end())
+			return nullptr;
+		return std::unique_ptr<libaction::Human>(
+			new libaction::Human(it->second));
+	}
+
+	// Scores in the form of score(), with the pairs libaction returns rather
+	// than the columns of compute_scores()
+	void do_score(const PoseTrack &sample, const PoseTrack &standard,
 		bool calculate_missed_moves,
 		std::uint8_t missed_threshold,
 		std::uint32_t missed_max_length,
@@ -394,65 +800,26 @@ private:
 					new std::list<std::map<std::pair<libaction::BodyPart::PartIndex,
 						libaction::BodyPart::PartIndex>, std::uint8_t>>());
 
-			auto part_means = std::unique_ptr<std::map<std::pair<libaction::BodyPart::PartIndex,
-				libaction::BodyPart::PartIndex>, std::uint8_t>>(
-					new std::map<std::pair<libaction::BodyPart::PartIndex,
-						libaction::BodyPart::PartIndex>, std::uint8_t>());
-
-			std::map<std::pair<libaction::BodyPart::PartIndex,
-				libaction::BodyPart::PartIndex>, std::uint64_t> part_sums;
-			std::map<std::pair<libaction::BodyPart::PartIndex,
-				libaction::BodyPart::PartIndex>, std::uint32_t> part_counts;
-			std::uint64_t frame_sum = 0;
-			std::uint32_t frame_count = 0;
-
-			auto sample_it = sample.begin();
-			auto standard_it = standard.begin();
-
-			for (std::size_t i = 0; i < sample.size() && i < standard.size();
-				i++, sample_it++, standard_it++)
-			{
-				auto &sample_frame = *sample_it;
-				auto &standard_frame = *standard_it;
+			ScoreSums sums;
 
-				auto human1_it = sample_frame.find(0);
-				if (human1_it == sample_frame.end()) {
+			auto frames = std::min(sample.frames(), standard.frames());
+			for (std::size_t i = 0; i < frames; i++) {
+				std::unique_ptr<libaction::Human> built1, built2;
+				auto human1 = sample.human(i, built1);
+				auto human2 = standard.human(i, built2);
+				if (!human1 || !human2) {
 					scores->push_back({});
 					continue;
 				}
 
-				auto human2_it = standard_frame.find(0);
-				if (human2_it == standard_frame.end()) {
-					scores->push_back({});
-					continue;
-				}
-
-				auto &human1 = human1_it->second;
-				auto &human2 = human2_it->second;
-
-				auto frame_scores = libaction::still::single::score::score(
-					human1, human2);
-
-				std::uint32_t sum = 0;
-				for (auto &score: *frame_scores) {
-					sum += static_cast<std::uint32_t>(score.second);
-					part_sums[score.first] += score.second;
-					part_counts[score.first]++;
-				}
-				if (!frame_scores->empty()) {
-					frame_sum += sum / frame_scores->size();
-					frame_count++;
-				}
+				auto frame_scores = score_pairs(*human1, *human2);
+				sums.add(*frame_scores);
 
 				scores->push_back(std::move(*frame_scores));
 			}
 
-			for (auto &score: part_sums) {
-				std::uint64_t current = score.second / part_counts[score.first];
-				(*part_means)[score.first] = current;
-			}
-
-			std::uint8_t mean = (frame_count != 0 ? frame_sum / frame_count : 0);
+			auto part_means = sums.part_means();
+			auto mean = sums.mean();
 
 			std::unique_ptr<std::list<std::map<std::pair<
 				libaction::BodyPart::PartIndex, libaction::BodyPart::PartIndex>,
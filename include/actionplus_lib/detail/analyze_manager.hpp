@@ -8,7 +8,12 @@
 #ifndef ACTIONPLUS_LIB__DETAIL__ANALYZE_MANAGER_HPP_
 #define ACTIONPLUS_LIB__DETAIL__ANALYZE_MANAGER_HPP_
 
+#include "../action_scores.hpp"
+#include "../action_stats.hpp"
+#include "../analysis_snapshot.hpp"
+#include "../live_score_session.hpp"
 #include "analyze_helper.hpp"
+#include "human_sequence.hpp"
 #include "worker.hpp"
 
 #include <cstddef>
@@ -16,6 +21,7 @@
 #include <functional>
 #include <libaction/body_part.hpp>
 #include <libaction/human.hpp>
+#include <list>
 #include <map>
 #include <memory>
 #include <mutex>
@@ -33,14 +39,18 @@ namespace detail
 class AnalyzeManager
 {
 public:
-	inline AnalyzeManager(const std::string &dir,
+	inline AnalyzeManager(Executor &executor, const std::string &dir,
 		std::unique_ptr<std::vector<std::uint8_t>> graph,
 		std::size_t graph_height, std::size_t graph_width,
 		std::function<void()> read_callback,
-		std::function<void()> write_callback) :
+		std::function<void()> write_callback,
+		std::size_t parallel_analyses = 1, bool cache_frames = false,
+		std::size_t analysis_cache_bytes = 256 * 1024 * 1024,
+		std::size_t read_threads = 1) :
 	write_update_callback(write_callback),
-	analyze_helper(dir, std::move(graph), graph_height, graph_width,
-		std::move(read_callback), write_callback)
+	analyze_helper(executor, dir, std::move(graph), graph_height, graph_width,
+		std::move(read_callback), write_callback, parallel_analyses,
+		cache_frames, analysis_cache_bytes, read_threads)
 	{}
 
 	// Analyze a video. An analyze write task will be immediately created.
@@ -49,25 +59,50 @@ public:
 	inline void analyze(const std::string &id)
 	{
 		analyze_helper.analyze(id, [this, id]
-			(std::size_t length,
+			(std::size_t length, std::size_t start,
 				std::unique_ptr<std::list<std::unique_ptr<libaction::Human>>>
 					humans) {
 				if (!humans || humans->size() == 0)
-					return;
+					return true;
 
 				std::unique_lock<std::mutex> lk(record_mtx);
 
-				analyze_record.id = id;
-				analyze_record.length = length;
-				analyze_record.humans = std::move(humans);
+				auto &record = find_record(id);
+				record.length = length;
+				if (start == 0)
+					record.humans.clear();
+				// Frames before start were lost. The helper reports all
+				// frames again.
+				if (start != record.humans.size())
+					return false;
+				for (auto &human: *humans)
+					record.humans.push_back(std::move(human));
+
+				// With parallel analyses, the first record is reported
+				bool current = &record == &analyze_records.front();
 
 				lk.unlock();
 
-				write_update_callback();
+				if (current)
+					write_update_callback();
+
+				return true;
 			},
-			[this] {
-				std::lock_guard<std::mutex> lk(record_mtx);
-				analyze_record = AnalyzeRecord();
+			[this, id] {
+				std::unique_lock<std::mutex> lk(record_mtx);
+
+				std::list<AnalyzeRecord> done;
+				for (auto it = analyze_records.begin();
+						it != analyze_records.end(); ++it) {
+					if (it->id == id) {
+						done.splice(done.end(), analyze_records, it);
+						break;
+					}
+				}
+
+				lk.unlock();
+
+				// Freed here, without holding record_mtx
 			}
 		);
 	}
@@ -81,11 +116,12 @@ public:
 		try {
 			std::unique_lock<std::mutex> lk(record_mtx);
 
+			const auto &analyze_record = current_record();
 			auto id = analyze_record.id;
 			auto length = analyze_record.length;
-			auto pos = 0;
-			if (analyze_record.humans && analyze_record.humans->size() > 0)
-				pos = analyze_record.humans->size() - 1;
+			std::size_t pos = 0;
+			if (analyze_record.humans.size() > 0)
+				pos = analyze_record.humans.size() - 1;
 
 			lk.unlock();
 
@@ -107,52 +143,62 @@ public:
 		std::unique_ptr<std::list<std::unique_ptr<libaction::Human>>> humans)>
 			callback)
 	{
-		try {
-			std::unique_lock<std::mutex> lk(record_mtx);
-
-			auto id = analyze_record.id;
-			auto length = analyze_record.length;
+		current_analysis_snapshot(0, [callback]
+				(const std::string &id, std::size_t length,
+					const AnalysisSnapshot &snapshot) {
+			if (id.empty()) {
+				callback(id, length, nullptr);
+				return;
+			}
 
-			std::shared_ptr<std::list<std::unique_ptr<libaction::Human>>>
-				humans_copy;
-			if (analyze_record.humans) {
-				humans_copy = std::shared_ptr<std::list<std::unique_ptr<
+			std::unique_ptr<std::list<std::unique_ptr<libaction::Human>>>
+				humans;
+			try {
+				humans = std::unique_ptr<std::list<std::unique_ptr<
 					libaction::Human>>>(
 						new std::list<std::unique_ptr<libaction::Human>>());
 
-				for (auto &human: *analyze_record.humans) {
+				for (std::size_t i = snapshot.begin(); i < snapshot.end(); i++) {
 					std::unique_ptr<libaction::Human> copy;
-					if (human) {
+					if (auto human = snapshot.human(i))
 						copy.reset(new libaction::Human(*human));
-					}
-					humans_copy->push_back(std::move(copy));
+					humans->push_back(std::move(copy));
 				}
+			} catch (...) {
+				callback("", 0, nullptr);
+				return;
 			}
 
+			callback(id, length, std::move(humans));
+		});
+	}
+
+	// Get frames [since, end) of the currently running analysis without
+	// copying them. Pass the end() of the previous snapshot as since to only
+	// get the new frames, as long as id and generation() are unchanged.
+	inline void current_analysis_snapshot(std::size_t since,
+		std::function<void(const std::string &id, std::size_t length,
+			const AnalysisSnapshot &snapshot)> callback)
+	{
+		try {
+			std::unique_lock<std::mutex> lk(record_mtx);
+
+			const auto &analyze_record = current_record();
+			auto id = analyze_record.id;
+			auto length = analyze_record.length;
+			auto snapshot = analyze_record.humans.snapshot(since);
+
 			lk.unlock();
 
-			analyze_helper.add_read_task([callback, id, length, humans_copy] {
+			analyze_helper.add_read_task([callback, id, length, snapshot] {
 				try {
-					std::unique_ptr<std::list<std::unique_ptr<libaction::Human>>>
-						humans_unique;
-					if (humans_copy) {
-						humans_unique = std::unique_ptr<std::list<std::unique_ptr<
-							libaction::Human>>>(
-								new std::list<std::unique_ptr<libaction::Human>>(
-									std::move(*humans_copy)));
-					}
-
-					try {
-						callback(id, length, std::move(humans_unique));
-					} catch (...) {}
-				} catch (...) {
-					callback("", 0, nullptr);
-				}
+					callback(id, length, snapshot);
+				} catch (...) {}
 			});
 		} catch (...) {
 			try {
 				analyze_helper.add_read_task([callback] {
-					callback("", 0, nullptr);
+					callback("", 0, AnalysisSnapshot());
 				});
 			} catch (...) {}
 		}
@@ -163,13 +209,35 @@ private:
 	{
 		std::string id{};
 		std::size_t length{};
-		std::unique_ptr<std::list<std::unique_ptr<libaction::Human>>> humans{};
+		HumanSequence humans{};
 	};
 
 	std::function<void()> write_update_callback;
 
+	// Records of the running analyses, in the order they first reported
+	// progress. Guarded by record_mtx.
 	std::mutex record_mtx{};
-	AnalyzeRecord analyze_record{};
+	std::list<AnalyzeRecord> analyze_records{};
+	const AnalyzeRecord empty_record{};
+
+	inline AnalyzeRecord &find_record(const std::string &id)
+	{
+		for (auto &record: analyze_records) {
+			if (record.id == id)
+				return record;
+		}
+
+		analyze_records.push_back(AnalyzeRecord());
+		analyze_records.back().id = id;
+		return analyze_records.back();
+	}
+
+	inline const AnalyzeRecord &current_record() const
+	{
+		if (analyze_records.empty())
+			return empty_record;
+		return analyze_records.front();
+	}
 
 	AnalyzeHelper analyze_helper;
 
@@ -184,6 +252,18 @@ public:
 		analyze_helper.get_analysis(id, std::move(callback));
 	}
 
+	// Get frames [first, first + count) of an existing (finished) analysis,
+	// or fewer at its end (humans is nullptr if not analyzed)
+	inline void get_analysis_range(const std::string &id, std::size_t first,
+		std::size_t count,
+		std::function<void(std::size_t length, std::size_t first,
+			std::unique_ptr<std::list<std::unique_ptr<libaction::Human>>>
+				humans)> callback)
+	{
+		analyze_helper.get_analysis_range(id, first, count,
+			std::move(callback));
+	}
+
 	// Score a video against a standard video. If one of the videos is not
 	// analyzed, scored will be false.
 	//
@@ -195,6 +275,29 @@ public:
 		analyze_helper.quick_score(sample_id, standard_id, std::move(callback));
 	}
 
+	// Score a video against many standard videos in parallel. results[i] is
+	// (scored, mean) against standard_ids[i], as in quick_score().
+	inline void batch_quick_score(const std::string &sample_id,
+		const std::vector<std::string> &standard_ids,
+		std::function<void(
+			std::unique_ptr<std::vector<std::pair<bool, std::uint8_t>>>
+				results)> callback)
+	{
+		analyze_helper.batch_quick_score(sample_id, standard_ids, callback);
+	}
+
+	// Score many videos against a standard video in parallel. results[i] is
+	// (scored, mean) of sample_ids[i], as in quick_score().
+	inline void batch_quick_score_samples(
+		const std::vector<std::string> &sample_ids,
+		const std::string &standard_id,
+		std::function<void(
+			std::unique_ptr<std::vector<std::pair<bool, std::uint8_t>>>
+				results)> callback)
+	{
+		analyze_helper.batch_quick_score_samples(sample_ids, standard_id, callback);
+	}
+
 	// Score a video against a standard video. If one of the videos is not
 	// analyzed, scored will be false.
 	inline void score(const std::string &sample_id,
@@ -217,6 +320,17 @@ public:
 			missed_max_length, std::move(callback));
 	}
 
+	// Score a video against a standard video, as one row of scores per frame
+	// and one column per ScorePairs entry. If one of the videos is not
+	// analyzed, scored will be false.
+	inline void score_matrix(const std::string &sample_id,
+		const std::string &standard_id,
+		std::function<void(bool scored, std::unique_ptr<ScoreMatrix> matrix)>
+			callback)
+	{
+		analyze_helper.score_matrix(sample_id, standard_id, callback);
+	}
+
 	// Score a video during analysis. If the standard video is not analyzed,
 	// scored will be false.
 	inline void live_score(
@@ -236,11 +350,41 @@ public:
 			std::move(callback));
 	}
 
+	// Start scoring a video during analysis against a standard video. The
+	// session scores only the frames added to it. If the standard video is
+	// not analyzed, session will be nullptr.
+	inline void live_score_session(const std::string &standard_id,
+		std::function<void(std::shared_ptr<LiveScoreSession> session)> callback)
+	{
+		analyze_helper.live_score_session(standard_id, callback);
+	}
+
 	inline void cancel_one()
 	{
 		analyze_helper.cancel_one();
 	}
 
+	inline EstimatorPoolStats estimator_pool_stats()
+	{
+		return analyze_helper.estimator_pool_stats();
+	}
+
+	inline AnalysisCacheStats analysis_cache_stats()
+	{
+		return analyze_helper.analysis_cache_stats();
+	}
+
+	inline void forget_analysis(const std::string &id)
+	{
+		analyze_helper.forget_analysis(id);
+	}
+
+	inline std::list<std::pair<std::string, VideoBufferStats>>
+		video_buffer_stats()
+	{
+		return analyze_helper.video_buffer_stats();
+	}
+
 	inline std::list<std::string> read_tasks()
 	{
 		return analyze_helper.read_tasks();
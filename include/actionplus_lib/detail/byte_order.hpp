@@ -0,0 +1,71 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * This Source Code Form is "Incompatible With Secondary Licenses", as
+ * defined by the Mozilla Public License, v. 2.0. */
+
+#ifndef ACTIONPLUS_LIB__DETAIL__BYTE_ORDER_HPP_
+#define ACTIONPLUS_LIB__DETAIL__BYTE_ORDER_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace actionplus_lib
+{
+namespace detail
+{
+namespace byte_order
+{
+
+// Little-endian encoding for the files written by this library
+
+inline void put_u32(uint8_t *dst, std::uint32_t value)
+{
+	for (std::size_t i = 0; i < 4; i++)
+		dst[i] = static_cast<uint8_t>(value >> (8 * i));
+}
+
+inline void put_u64(uint8_t *dst, std::uint64_t value)
+{
+	for (std::size_t i = 0; i < 8; i++)
+		dst[i] = static_cast<uint8_t>(value >> (8 * i));
+}
+
+inline void put_f32(uint8_t *dst, float value)
+{
+	std::uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	put_u32(dst, bits);
+}
+
+inline std::uint32_t get_u32(const uint8_t *src)
+{
+	std::uint32_t value = 0;
+	for (std::size_t i = 0; i < 4; i++)
+		value |= static_cast<std::uint32_t>(src[i]) << (8 * i);
+	return value;
+}
+
+inline std::uint64_t get_u64(const uint8_t *src)
+{
+	std::uint64_t value = 0;
+	for (std::size_t i = 0; i < 8; i++)
+		value |= static_cast<std::uint64_t>(src[i]) << (8 * i);
+	return value;
+}
+
+inline float get_f32(const uint8_t *src)
+{
+	std::uint32_t bits = get_u32(src);
+	float value;
+	std::memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+}
+}
+}
+
+#endif
@@ -0,0 +1,108 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * This Source Code Form is "Incompatible With Secondary Licenses", as
+ * defined by the Mozilla Public License, v. 2.0. */
+
+#ifndef ACTIONPLUS_LIB__DETAIL__CORE_BUDGET_HPP_
+#define ACTIONPLUS_LIB__DETAIL__CORE_BUDGET_HPP_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <list>
+#include <mutex>
+
+namespace actionplus_lib
+{
+namespace detail
+{
+
+// Splits a fixed number of cores between the jobs that are running at the
+// same time. Shares are recomputed on every call, so a job picks up the cores
+// of a finished job the next time it asks.
+class CoreBudget
+{
+public:
+	inline CoreBudget(std::size_t cores) :
+	total(std::max(cores, static_cast<std::size_t>(1)))
+	{}
+
+	CoreBudget(const CoreBudget &) = delete;
+	CoreBudget &operator=(const CoreBudget &) = delete;
+
+	// A job's membership in the budget. Joins on construction and leaves on
+	// destruction.
+	class Lease
+	{
+	public:
+		inline Lease(CoreBudget &core_budget) : budget(core_budget)
+		{
+			std::lock_guard<std::mutex> lk(budget.mtx);
+			id = budget.next_id++;
+			budget.jobs.push_back(id);
+		}
+
+		inline ~Lease()
+		{
+			std::lock_guard<std::mutex> lk(budget.mtx);
+			budget.jobs.remove(id);
+		}
+
+		Lease(const Lease &) = delete;
+		Lease &operator=(const Lease &) = delete;
+
+		// Number of cores this job may use right now (at least 1)
+		inline std::size_t share() const
+		{
+			return budget.share(id);
+		}
+
+	private:
+		CoreBudget &budget;
+		std::uint64_t id{};
+	};
+
+	inline std::size_t cores() const
+	{
+		return total;
+	}
+
+	inline std::size_t active_jobs()
+	{
+		std::lock_guard<std::mutex> lk(mtx);
+		return jobs.size();
+	}
+
+private:
+	const std::size_t total;
+
+	std::mutex mtx{};
+	std::uint64_t next_id{0};
+	// In joining order. Earlier jobs get the remainder of the division.
+	std::list<std::uint64_t> jobs{};
+
+	inline std::size_t share(std::uint64_t id)
+	{
+		std::lock_guard<std::mutex> lk(mtx);
+
+		if (jobs.empty())
+			return total;
+
+		std::size_t pos = std::distance(jobs.begin(),
+			std::find(jobs.begin(), jobs.end(), id));
+
+		std::size_t result = total / jobs.size();
+		if (pos < total % jobs.size())
+			result++;
+
+		return std::max(result, static_cast<std::size_t>(1));
+	}
+};
+
+}
+}
+
+#endif
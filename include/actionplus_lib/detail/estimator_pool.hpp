@@ -0,0 +1,186 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * This Source Code Form is "Incompatible With Secondary Licenses", as
+ * defined by the Mozilla Public License, v. 2.0. */
+
+#ifndef ACTIONPLUS_LIB__DETAIL__ESTIMATOR_POOL_HPP_
+#define ACTIONPLUS_LIB__DETAIL__ESTIMATOR_POOL_HPP_
+
+#include "../action_stats.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <libaction/still/single/estimator.hpp>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace actionplus_lib
+{
+namespace detail
+{
+
+// Still estimators shared by all analyses. Estimators are created on first
+// demand, up to max_size, and are kept for the lifetime of the pool.
+class EstimatorPool
+{
+public:
+	using Estimator = libaction::still::single::Estimator<float>;
+
+	inline EstimatorPool(const std::vector<uint8_t> &graph,
+		// graph must be kept throughout lifetime
+		std::size_t graph_height, std::size_t graph_width,
+		std::size_t max_size) :
+	graph_data(graph), height(graph_height), width(graph_width),
+	max_estimators(std::max(max_size, static_cast<std::size_t>(1)))
+	{}
+
+	EstimatorPool(const EstimatorPool &) = delete;
+	EstimatorPool &operator=(const EstimatorPool &) = delete;
+
+	// Estimators leased to one user. They are returned on destruction.
+	class Lease
+	{
+	public:
+		inline Lease(EstimatorPool &estimator_pool,
+			std::vector<Estimator *> leased) :
+		pool(estimator_pool), estimator_list(std::move(leased))
+		{}
+
+		inline ~Lease()
+		{
+			pool.give_back(estimator_list);
+		}
+
+		Lease(const Lease &) = delete;
+		Lease &operator=(const Lease &) = delete;
+
+		inline const std::vector<Estimator *> &estimators() const
+		{
+			return estimator_list;
+		}
+
+	private:
+		EstimatorPool &pool;
+		std::vector<Estimator *> estimator_list;
+	};
+
+	// Lease up to `count` estimators. Waits until at least one is available.
+	inline std::unique_ptr<Lease> lease(std::size_t count)
+	{
+		count = std::max(count, static_cast<std::size_t>(1));
+
+		auto start = std::chrono::steady_clock::now();
+
+		std::unique_lock<std::mutex> lk(mtx);
+		cv.wait(lk, [this] {
+			return !idle.empty() ||
+				estimators.size() + creating < max_estimators;
+		});
+
+		// Create the missing ones outside the lock, since loading the graph
+		// is slow
+		std::size_t create = 0;
+		if (idle.size() < count) {
+			create = std::min(count - idle.size(),
+				max_estimators - estimators.size() - creating);
+			creating += create;
+		}
+
+		std::vector<Estimator *> leased;
+		while (!idle.empty() && leased.size() < count) {
+			leased.push_back(idle.back());
+			idle.pop_back();
+		}
+
+		lk.unlock();
+
+		std::vector<std::unique_ptr<Estimator>> created;
+		try {
+			for (std::size_t i = 0; i < create; i++) {
+				created.push_back(std::unique_ptr<Estimator>(new Estimator(
+					graph_data.data(), graph_data.size(), 1, height, width, 3)));
+			}
+		} catch (...) {
+			// Keep the ones created before the failure for other users
+			lk.lock();
+			creating -= create;
+			for (auto &est: created) {
+				idle.push_back(est.get());
+				estimators.push_back(std::move(est));
+			}
+			for (auto &est: leased)
+				idle.push_back(est);
+			lk.unlock();
+			cv.notify_all();
+			throw;
+		}
+
+		auto wait = std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - start).count();
+
+		lk.lock();
+		creating -= create;
+		for (auto &est: created) {
+			leased.push_back(est.get());
+			estimators.push_back(std::move(est));
+		}
+		leases++;
+		wait_ns += wait;
+		max_wait_ns = std::max(max_wait_ns, static_cast<std::uint64_t>(wait));
+		lk.unlock();
+
+		return std::unique_ptr<Lease>(new Lease(*this, std::move(leased)));
+	}
+
+	inline EstimatorPoolStats stats()
+	{
+		std::lock_guard<std::mutex> lk(mtx);
+
+		EstimatorPoolStats result;
+		result.size = estimators.size();
+		result.idle = idle.size();
+		result.max_size = max_estimators;
+		result.leases = leases;
+		result.lease_wait_ns = wait_ns;
+		result.max_lease_wait_ns = max_wait_ns;
+		return result;
+	}
+
+private:
+	const std::vector<uint8_t> &graph_data;
+	const std::size_t height;
+	const std::size_t width;
+	const std::size_t max_estimators;
+
+	std::mutex mtx{};
+	std::condition_variable cv{};
+
+	std::vector<std::unique_ptr<Estimator>> estimators{};
+	std::vector<Estimator *> idle{};
+	std::size_t creating{0};
+
+	std::uint64_t leases{0};
+	std::uint64_t wait_ns{0};
+	std::uint64_t max_wait_ns{0};
+
+	inline void give_back(const std::vector<Estimator *> &leased)
+	{
+		{
+			std::lock_guard<std::mutex> lk(mtx);
+			for (auto &est: leased)
+				idle.push_back(est);
+		}
+		cv.notify_all();
+	}
+};
+
+}
+}
+
+#endif
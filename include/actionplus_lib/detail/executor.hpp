@@ -0,0 +1,242 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * This Source Code Form is "Incompatible With Secondary Licenses", as
+ * defined by the Mozilla Public License, v. 2.0. */
+
+#ifndef ACTIONPLUS_LIB__DETAIL__EXECUTOR_HPP_
+#define ACTIONPLUS_LIB__DETAIL__EXECUTOR_HPP_
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+namespace actionplus_lib
+{
+namespace detail
+{
+
+// Priorities of the lanes of an ActionManager
+namespace priority
+{
+
+// Trash cleaning
+const int background = 0;
+// Imports, exports and analyses, which take long anyway
+const int bulk = 1;
+const int write = 2;
+// Helpers of reads, which are only waited for while they run an item
+const int read_helper = 3;
+// Reads the user waits for
+const int read = 4;
+
+}
+
+// Threads shared by lanes of tasks. A lane runs up to its own number of
+// tasks at the same time, in the order they were added, so a lane of one
+// thread runs its tasks one by one.
+//
+// Threads are started when a task could run but no thread is idle, up to
+// max_threads (0 for no limit). A slow task then only holds up its own lane.
+// When threads are short, tasks of lanes of higher priority start first, and
+// tasks of the same priority in the order they were added.
+class Executor
+{
+public:
+	inline Executor(std::size_t max_threads = 0) :
+	thread_limit(max_threads)
+	{}
+
+	inline ~Executor()
+	{
+		stop();
+	}
+
+	Executor(const Executor &) = delete;
+	Executor &operator=(const Executor &) = delete;
+
+	// callback is called when a task of the lane starts and finishes
+	inline std::size_t add_lane(std::function<void()> callback,
+		std::size_t threads, int lane_priority)
+	{
+		std::lock_guard<std::mutex> lk(mtx);
+		lanes.push_back(Lane{std::move(callback), std::max(threads,
+			static_cast<std::size_t>(1)), lane_priority, 0, {}});
+		return lanes.size() - 1;
+	}
+
+	inline void add(std::size_t lane, std::function<void()> task,
+		std::string desc)
+	{
+		std::lock_guard<std::mutex> lk(mtx);
+		lanes[lane].tasks.push_back(Task{std::move(task), std::move(desc),
+			next_seq++, false});
+
+		while (runnable() > idle &&
+				(thread_limit == 0 || thread_list.size() < thread_limit)) {
+			try {
+				thread_list.push_back(std::thread(std::bind(&Executor::work,
+					this)));
+			} catch (...) {
+				// Existing threads will run it
+				if (thread_list.empty())
+					throw;
+				break;
+			}
+			idle++;
+		}
+
+		cv.notify_all();
+	}
+
+	// Descriptions of the waiting and running tasks of a lane
+	inline std::list<std::string> tasks(std::size_t lane)
+	{
+		std::list<std::string> list;
+
+		std::lock_guard<std::mutex> lk(mtx);
+		for (auto &task: lanes[lane].tasks)
+			list.push_back(task.desc);
+
+		return list;
+	}
+
+	inline void stop()
+	{
+		std::lock_guard<std::mutex> lk(mtx);
+		if (!thread_list.empty()) {
+			// TODO: For now, if this happens, we just terminate the process to
+			//       avoid waiting for the long-running threads
+			std::_Exit(0);
+			// for (auto &thread: thread_list)
+			// 	thread.join();
+		}
+	}
+
+private:
+	struct Task
+	{
+		std::function<void()> func;
+		std::string desc;
+		std::uint64_t seq;
+		bool running;
+	};
+
+	struct Lane
+	{
+		std::function<void()> update_callback;
+		std::size_t threads;
+		int priority;
+		std::size_t running;
+		// Running tasks stay in the list until they finish
+		std::list<Task> tasks;
+	};
+
+	const std::size_t thread_limit;
+
+	std::mutex mtx{};
+	std::condition_variable cv{};
+	std::deque<Lane> lanes{};
+	std::list<std::thread> thread_list{};
+	// Threads waiting for a task, or started and not yet waiting
+	std::size_t idle{0};
+	std::uint64_t next_seq{0};
+
+	// Tasks that could start now. mtx must be held.
+	inline std::size_t runnable()
+	{
+		std::size_t count = 0;
+		for (auto &lane: lanes) {
+			if (lane.running < lane.threads) {
+				count += std::min(lane.threads - lane.running,
+					lane.tasks.size() - lane.running);
+			}
+		}
+		return count;
+	}
+
+	// mtx must be held
+	inline bool next_task(std::size_t &lane_index,
+		std::list<Task>::iterator &task)
+	{
+		bool found = false;
+		for (std::size_t i = 0; i < lanes.size(); i++) {
+			auto &lane = lanes[i];
+			if (lane.running >= lane.threads)
+				continue;
+
+			auto it = std::find_if(lane.tasks.begin(), lane.tasks.end(),
+				[] (const Task &t) { return !t.running; });
+			if (it == lane.tasks.end())
+				continue;
+
+			if (!found || lane.priority > lanes[lane_index].priority ||
+					(lane.priority == lanes[lane_index].priority &&
+						it->seq < task->seq)) {
+				found = true;
+				lane_index = i;
+				task = it;
+			}
+		}
+		return found;
+	}
+
+	inline void work()
+	{
+		std::unique_lock<std::mutex> lk(mtx);
+
+		while (true) {
+			try {
+				std::size_t lane_index = 0;
+				std::list<Task>::iterator it;
+				cv.wait(lk, [this, &lane_index, &it] {
+					return next_task(lane_index, it);
+				});
+				idle--;
+
+				auto &lane = lanes[lane_index];
+				it->running = true;
+				lane.running++;
+				auto task = it->func;
+				auto callback = lane.update_callback;
+
+				lk.unlock();
+
+				try {
+					callback();
+				} catch (...) {}
+
+				try {
+					task();
+				} catch (...) {}
+
+				lk.lock();
+				lane.tasks.erase(it);
+				lane.running--;
+				lk.unlock();
+
+				try {
+					callback();
+				} catch (...) {}
+
+				lk.lock();
+				idle++;
+			} catch (...) {}
+		}
+	}
+};
+
+}
+}
+
+#endif
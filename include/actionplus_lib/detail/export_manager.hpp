@@ -25,9 +25,9 @@ namespace detail
 class ExportManager
 {
 public:
-	inline ExportManager(const std::string &dir,
+	inline ExportManager(Executor &executor, const std::string &dir,
 		std::function<void()> callback) :
-	storage_dir(dir + "/storage"), worker(callback)
+	storage_dir(dir + "/storage"), worker(executor, priority::bulk, callback)
 	{}
 
 	// Export a video
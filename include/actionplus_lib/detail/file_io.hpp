@@ -0,0 +1,157 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * This Source Code Form is "Incompatible With Secondary Licenses", as
+ * defined by the Mozilla Public License, v. 2.0. */
+
+#ifndef ACTIONPLUS_LIB__DETAIL__FILE_IO_HPP_
+#define ACTIONPLUS_LIB__DETAIL__FILE_IO_HPP_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <vector>
+
+namespace actionplus_lib
+{
+namespace detail
+{
+
+// Frame counts in the headers of the files written by this library, above
+// which the header is rejected as corrupted. Far above the 30 minutes that
+// VideoReader reads.
+const std::uint64_t max_file_frames = 0x1000000;
+
+// 0 if unknown
+inline std::uint64_t file_size(FILE *f)
+{
+#ifndef _WIN32
+	struct stat st;
+	if (fstat(fileno(f), &st) != 0 || st.st_size <= 0)
+		return 0;
+#else
+	struct _stat64 st;
+	if (_fstat64(_fileno(f), &st) != 0 || st.st_size <= 0)
+		return 0;
+#endif
+	return static_cast<std::uint64_t>(st.st_size);
+}
+
+// A version of a file. Files here are replaced by renaming a new file over
+// them, which gives them a new inode, and the modification time is in
+// nanoseconds where the platform has them.
+struct FileStamp
+{
+	std::uint64_t size;
+	std::uint64_t mtime_ns;
+	std::uint64_t inode;
+
+	inline bool operator==(const FileStamp &other) const
+	{
+		return size == other.size && mtime_ns == other.mtime_ns &&
+			inode == other.inode;
+	}
+
+	inline bool operator!=(const FileStamp &other) const
+	{
+		return !(*this == other);
+	}
+};
+
+// Throws if the file is missing
+inline FileStamp file_stamp(const std::string &file)
+{
+	const std::uint64_t ns = 1000000000;
+
+#ifndef _WIN32
+	struct stat st;
+	if (stat(file.c_str(), &st) != 0)
+		throw std::runtime_error("failed to stat file");
+#ifdef __APPLE__
+	auto mtime = st.st_mtimespec;
+#else
+	auto mtime = st.st_mtim;
+#endif
+	return FileStamp{static_cast<std::uint64_t>(st.st_size),
+		static_cast<std::uint64_t>(mtime.tv_sec) * ns +
+			static_cast<std::uint64_t>(mtime.tv_nsec),
+		static_cast<std::uint64_t>(st.st_ino)};
+#else
+	struct _stat64 st;
+	if (_stat64(file.c_str(), &st) != 0)
+		throw std::runtime_error("failed to stat file");
+	return FileStamp{static_cast<std::uint64_t>(st.st_size),
+		static_cast<std::uint64_t>(st.st_mtime) * ns, 0};
+#endif
+}
+
+// Files written by this library may be larger than what fseek() can address
+// on some platforms
+inline int seek_file(FILE *f, std::uint64_t offset)
+{
+#ifndef _WIN32
+	return fseeko(f, static_cast<off_t>(offset), SEEK_SET);
+#else
+	return _fseeki64(f, static_cast<__int64>(offset), SEEK_SET);
+#endif
+}
+
+inline std::unique_ptr<std::vector<std::uint8_t>> read_file(
+	const std::string &file)
+{
+	constexpr std::size_t max = 0x20000000;
+
+	FILE *f = std::fopen(file.c_str(), "rb");
+	if (!f)
+		throw std::runtime_error("failed to open file");
+
+	auto data = std::unique_ptr<std::vector<std::uint8_t>>(
+		new std::vector<std::uint8_t>());
+
+	// Read the whole file at once when its size is known
+	data->resize(static_cast<std::size_t>(std::min(file_size(f),
+		static_cast<std::uint64_t>(max))));
+
+	std::size_t size = 0;
+	while (true) {
+		if (size == data->size()) {
+			// Only grow if there is more to read than expected
+			if (size >= max)
+				break;
+			int c = std::fgetc(f);
+			if (c == EOF)
+				break;
+			data->resize(std::min(std::max(size * 2,
+				static_cast<std::size_t>(0x10000)), max));
+			(*data)[size++] = static_cast<std::uint8_t>(c);
+		}
+
+		auto read = std::fread(data->data() + size, 1,
+			data->size() - size, f);
+		size += read;
+		if (read == 0)
+			break;
+	}
+
+	if (std::ferror(f)) {
+		std::fclose(f);
+		throw std::runtime_error("failed to read file");
+	}
+
+	std::fclose(f);
+
+	data->resize(size);
+	return data;
+}
+
+}
+}
+
+#endif
@@ -0,0 +1,344 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * This Source Code Form is "Incompatible With Secondary Licenses", as
+ * defined by the Mozilla Public License, v. 2.0. */
+
+#ifndef ACTIONPLUS_LIB__DETAIL__FRAME_CACHE_HPP_
+#define ACTIONPLUS_LIB__DETAIL__FRAME_CACHE_HPP_
+
+#include "byte_order.hpp"
+#include "file_io.hpp"
+#include "frame_pool.hpp"
+#include "sync_file.hpp"
+
+#include <boost/filesystem.hpp>
+#include <boost/multi_array.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace actionplus_lib
+{
+namespace detail
+{
+
+// Decoded and scaled frames of a video, stored so that analyzing the video
+// again does not need to decode it.
+//
+// Layout (little-endian):
+//   0   magic "APFRAMES" (zeros until the file is complete)
+//   8   u32 version
+//   12  u32 channels
+//   16  u64 frames
+//   24  u64 frame height, 32 u64 frame width (after rotation)
+//   40  u64 scale height, 48 u64 scale width (as requested from the reader)
+//   56  u64 reserved
+//   64  u8 per frame: 1 if the frame is valid
+//   then, at a multiple of 4096, the raw RGB frames back to back
+//
+// Frame i starts at a fixed offset, so the file can be memory mapped.
+namespace frame_cache
+{
+
+const char magic[8]{'A', 'P', 'F', 'R', 'A', 'M', 'E', 'S'};
+const std::uint32_t version = 1;
+const std::size_t header_size = 64;
+const std::size_t alignment = 4096;
+
+inline std::uint64_t data_offset(std::uint64_t frames)
+{
+	return (header_size + frames + alignment - 1) / alignment * alignment;
+}
+
+}
+
+class FrameCacheWriter
+{
+public:
+	// Frames are written to tmp_file, which is moved to file by finish()
+	inline FrameCacheWriter(const std::string &cache_file,
+		const std::string &tmp_cache_file, std::size_t frame_count,
+		std::size_t scale_height, std::size_t scale_width,
+		std::size_t frame_height, std::size_t frame_width) :
+	file(cache_file), tmp_file(tmp_cache_file), frames(frame_count),
+	scale_h(scale_height), scale_w(scale_width),
+	height(frame_height), width(frame_width),
+	frame_size(frame_height * frame_width * 3),
+	valid(frame_count, 0)
+	{
+		if (frame_size == 0)
+			throw std::runtime_error("unknown frame size");
+
+		f = std::fopen(tmp_file.c_str(), "wb");
+		if (!f)
+			throw std::runtime_error("failed to open file");
+
+		// Header and flags are written by finish()
+		std::vector<uint8_t> zeros(frame_cache::data_offset(frames));
+		if (std::fwrite(zeros.data(), 1, zeros.size(), f) < zeros.size()) {
+			discard();
+			throw std::runtime_error("failed to write file");
+		}
+	}
+
+	inline ~FrameCacheWriter()
+	{
+		discard();
+	}
+
+	FrameCacheWriter(const FrameCacheWriter &) = delete;
+	FrameCacheWriter &operator=(const FrameCacheWriter &) = delete;
+
+	inline std::size_t written() const
+	{
+		return next;
+	}
+
+	// Frames must be written in order. Frames of another shape are stored
+	// as invalid.
+	inline void write(const boost::multi_array<uint8_t, 3> &image)
+	{
+		if (!f || next >= frames)
+			throw std::runtime_error("cannot write frame");
+
+		const uint8_t *data = image.data();
+		std::vector<uint8_t> zeros;
+
+		if (image.shape()[0] == height && image.shape()[1] == width &&
+				image.shape()[2] == 3) {
+			valid[next] = 1;
+		} else {
+			zeros.resize(frame_size);
+			data = zeros.data();
+		}
+
+		if (std::fwrite(data, 1, frame_size, f) < frame_size) {
+			discard();
+			throw std::runtime_error("failed to write file");
+		}
+
+		next++;
+	}
+
+	// All frames must have been written
+	inline void finish()
+	{
+		if (!f || next != frames)
+			throw std::runtime_error("cannot finish cache");
+
+		uint8_t header[frame_cache::header_size]{};
+		std::memcpy(header, frame_cache::magic, sizeof(frame_cache::magic));
+		byte_order::put_u32(header + 8, frame_cache::version);
+		byte_order::put_u32(header + 12, 3);
+		byte_order::put_u64(header + 16, frames);
+		byte_order::put_u64(header + 24, height);
+		byte_order::put_u64(header + 32, width);
+		byte_order::put_u64(header + 40, scale_h);
+		byte_order::put_u64(header + 48, scale_w);
+
+		if (seek_file(f, 0) != 0 ||
+				std::fwrite(header, 1, sizeof(header), f) < sizeof(header) ||
+				std::fwrite(valid.data(), 1, valid.size(), f) < valid.size()) {
+			discard();
+			throw std::runtime_error("failed to write file");
+		}
+
+		std::fclose(f);
+		f = nullptr;
+
+		sync_file(tmp_file);
+
+		boost::filesystem::rename(tmp_file, file);
+	}
+
+private:
+	const std::string file;
+	const std::string tmp_file;
+	const std::size_t frames;
+	const std::size_t scale_h;
+	const std::size_t scale_w;
+	const std::size_t height;
+	const std::size_t width;
+	const std::size_t frame_size;
+
+	FILE *f{};
+	std::size_t next{0};
+	std::vector<uint8_t> valid;
+
+	inline void discard()
+	{
+		if (f) {
+			std::fclose(f);
+			f = nullptr;
+			try {
+				boost::filesystem::remove(tmp_file);
+			} catch (...) {}
+		}
+	}
+};
+
+// Reads a frame cache with the same interface as VideoReader
+class FrameCacheReader
+{
+public:
+	// Throws if the file is missing, incomplete or was written for another
+	// scale or frame shape
+	inline FrameCacheReader(const std::string &cache_file,
+		std::size_t scale_height, std::size_t scale_width,
+		std::shared_ptr<FramePool> pool) :
+	frame_pool(pool ? pool : std::make_shared<FramePool>(1))
+	{
+		f = std::fopen(cache_file.c_str(), "rb");
+		if (!f)
+			throw std::runtime_error("failed to open file");
+
+		uint8_t header[frame_cache::header_size];
+		if (std::fread(header, 1, sizeof(header), f) < sizeof(header) ||
+				std::memcmp(header, frame_cache::magic,
+					sizeof(frame_cache::magic)) != 0 ||
+				byte_order::get_u32(header + 8) != frame_cache::version ||
+				byte_order::get_u32(header + 12) != 3 ||
+				byte_order::get_u64(header + 40) != scale_height ||
+				byte_order::get_u64(header + 48) != scale_width) {
+			std::fclose(f);
+			throw std::runtime_error("invalid frame cache");
+		}
+
+		auto frame_count = byte_order::get_u64(header + 16);
+		auto frame_height = byte_order::get_u64(header + 24);
+		auto frame_width = byte_order::get_u64(header + 32);
+
+		// The frames have the shape VideoReader gives them for this scale,
+		// which is swapped if the video is rotated, and must all be in the
+		// file
+		bool shape_ok = (frame_height == scale_height &&
+				frame_width == scale_width) ||
+			(frame_height == scale_width && frame_width == scale_height);
+		if (!shape_ok || frame_height == 0 || frame_width == 0 ||
+				frame_count > max_file_frames ||
+				file_size(f) < frame_cache::data_offset(frame_count) +
+					frame_count * frame_height * frame_width * 3) {
+			std::fclose(f);
+			throw std::runtime_error("invalid frame cache");
+		}
+
+		tot_frames = static_cast<std::size_t>(frame_count);
+		height = static_cast<std::size_t>(frame_height);
+		width = static_cast<std::size_t>(frame_width);
+		frame_size = height * width * 3;
+
+		valid.resize(tot_frames);
+		if (std::fread(valid.data(), 1, valid.size(), f) < valid.size()) {
+			std::fclose(f);
+			throw std::runtime_error("invalid frame cache");
+		}
+	}
+
+	inline ~FrameCacheReader()
+	{
+		std::fclose(f);
+	}
+
+	FrameCacheReader(const FrameCacheReader &) = delete;
+	FrameCacheReader &operator=(const FrameCacheReader &) = delete;
+
+	inline std::size_t frames() const
+	{
+		return tot_frames;
+	}
+
+	inline std::size_t frame_height() const
+	{
+		return height;
+	}
+
+	inline std::size_t frame_width() const
+	{
+		return width;
+	}
+
+	inline std::size_t next_index()
+	{
+		return next;
+	}
+
+	inline std::shared_ptr<boost::multi_array<uint8_t, 3>> read(std::size_t index)
+	{
+		if (index >= tot_frames)
+			throw std::runtime_error("index >= tot_frames");
+
+		while (next <= index) {
+			std::shared_ptr<boost::multi_array<uint8_t, 3>> image;
+
+			if (valid[next] && seek_file(f,
+					frame_cache::data_offset(tot_frames) +
+						static_cast<std::uint64_t>(next) * frame_size) == 0) {
+				image = frame_pool->get(height, width, 3);
+				if (std::fread(image->data(), 1, frame_size, f) < frame_size)
+					image.reset();
+			}
+
+			if (!image) {
+				image = std::shared_ptr<boost::multi_array<uint8_t, 3>>(
+					new boost::multi_array<uint8_t, 3>(
+						boost::extents[1][1][3]));
+			}
+
+			data.push_back(std::move(image));
+			next++;
+		}
+
+		if (index < data_begin || !data[index - data_begin])
+			throw std::runtime_error("data not found");
+		return data[index - data_begin];
+	}
+
+	inline std::shared_ptr<boost::multi_array<uint8_t, 3>> take(std::size_t index)
+	{
+		read(index);
+		auto image = std::move(data[index - data_begin]);
+		remove(index);
+		return image;
+	}
+
+	inline void remove(std::size_t index)
+	{
+		if (index < data_begin || index - data_begin >= data.size())
+			return;
+
+		data[index - data_begin].reset();
+		while (!data.empty() && !data.front()) {
+			data.pop_front();
+			data_begin++;
+		}
+	}
+
+private:
+	std::shared_ptr<FramePool> frame_pool;
+
+	FILE *f{};
+	std::size_t tot_frames{0};
+	std::size_t height{0};
+	std::size_t width{0};
+	std::size_t frame_size{0};
+	std::vector<uint8_t> valid{};
+
+	std::size_t next{0};
+
+	// Frames [data_begin, next) that are not removed yet
+	std::size_t data_begin{0};
+	std::deque<std::shared_ptr<boost::multi_array<uint8_t, 3>>> data{};
+};
+
+}
+}
+
+#endif
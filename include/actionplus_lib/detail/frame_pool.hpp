@@ -0,0 +1,93 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * This Source Code Form is "Incompatible With Secondary Licenses", as
+ * defined by the Mozilla Public License, v. 2.0. */
+
+#ifndef ACTIONPLUS_LIB__DETAIL__FRAME_POOL_HPP_
+#define ACTIONPLUS_LIB__DETAIL__FRAME_POOL_HPP_
+
+#include <boost/multi_array.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace actionplus_lib
+{
+namespace detail
+{
+
+// Recycles frame images. An image handed out by get() goes back to the pool
+// when its last shared_ptr is released, so a steady stream of frames of the
+// same size needs no new image allocations. The pool may be destroyed before
+// the images it handed out.
+class FramePool
+{
+public:
+	using Image = boost::multi_array<uint8_t, 3>;
+
+	// At most max_idle released images are kept for reuse
+	inline FramePool(std::size_t max_idle) :
+	state(std::make_shared<State>(max_idle))
+	{}
+
+	// Contents of the returned image are unspecified
+	inline std::shared_ptr<Image> get(std::size_t height, std::size_t width,
+		std::size_t channels)
+	{
+		std::unique_ptr<Image> image;
+
+		{
+			std::lock_guard<std::mutex> lk(state->mtx);
+			for (auto it = state->idle.begin(); it != state->idle.end(); ++it) {
+				auto shape = (*it)->shape();
+				if (shape[0] == height && shape[1] == width &&
+						shape[2] == channels) {
+					image = std::move(*it);
+					*it = std::move(state->idle.back());
+					state->idle.pop_back();
+					break;
+				}
+			}
+		}
+
+		if (!image) {
+			image = std::unique_ptr<Image>(new Image(
+				boost::extents[height][width][channels]));
+		}
+
+		std::shared_ptr<State> pool_state = state;
+		return std::shared_ptr<Image>(image.release(), [pool_state]
+				(Image *released) {
+			std::unique_ptr<Image> owned(released);
+			try {
+				std::lock_guard<std::mutex> lk(pool_state->mtx);
+				if (pool_state->idle.size() < pool_state->max_idle)
+					pool_state->idle.push_back(std::move(owned));
+			} catch (...) {}
+		});
+	}
+
+private:
+	struct State
+	{
+		inline State(std::size_t max) : max_idle(max)
+		{
+			idle.reserve(max_idle);
+		}
+
+		const std::size_t max_idle;
+		std::mutex mtx{};
+		std::vector<std::unique_ptr<Image>> idle{};
+	};
+
+	std::shared_ptr<State> state;
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,93 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * This Source Code Form is "Incompatible With Secondary Licenses", as
+ * defined by the Mozilla Public License, v. 2.0. */
+
+#ifndef ACTIONPLUS_LIB__DETAIL__HUMAN_SEQUENCE_HPP_
+#define ACTIONPLUS_LIB__DETAIL__HUMAN_SEQUENCE_HPP_
+
+#include "../analysis_snapshot.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <libaction/human.hpp>
+#include <memory>
+#include <vector>
+
+namespace actionplus_lib
+{
+namespace detail
+{
+
+// Append-only frames of an analysis, one Human or nullptr each. Appending
+// only writes slots past the end of every snapshot taken so far, so
+// snapshots stay valid without copying. Not thread-safe by itself: append,
+// clear and snapshot must be serialized by the owner.
+class HumanSequence
+{
+public:
+	using Chunk = AnalysisSnapshot::Chunk;
+	using ChunkList = AnalysisSnapshot::ChunkList;
+
+	inline std::size_t size() const
+	{
+		return count;
+	}
+
+	inline std::uint64_t generation() const
+	{
+		return gen;
+	}
+
+	// Snapshots taken before keep their frames
+	inline void clear()
+	{
+		chunks.reset();
+		tail.reset();
+		count = 0;
+		gen++;
+	}
+
+	inline void push_back(std::unique_ptr<libaction::Human> human)
+	{
+		if (count % AnalysisSnapshot::chunk_size == 0) {
+			// Full chunks are shared with the old list, which snapshots may
+			// still hold
+			auto list = std::make_shared<ChunkList>();
+			if (chunks) {
+				list->reserve(chunks->size() + 1);
+				*list = *chunks;
+			}
+
+			tail = std::make_shared<Chunk>(
+				static_cast<std::size_t>(AnalysisSnapshot::chunk_size));
+			list->push_back(tail);
+			chunks = list;
+		}
+
+		(*tail)[count % AnalysisSnapshot::chunk_size] =
+			std::shared_ptr<const libaction::Human>(std::move(human));
+		count++;
+	}
+
+	// Frames from since (or from the end, if since is past it) to the end
+	inline AnalysisSnapshot snapshot(std::size_t since = 0) const
+	{
+		return AnalysisSnapshot(chunks, std::min(since, count), count, gen);
+	}
+
+private:
+	std::shared_ptr<ChunkList> chunks{};
+	// Last chunk of chunks, which is written by push_back()
+	std::shared_ptr<Chunk> tail{};
+	std::size_t count{0};
+	std::uint64_t gen{0};
+};
+
+}
+}
+
+#endif
@@ -33,9 +33,9 @@ namespace detail
 class ImportTempManager
 {
 public:
-	inline ImportTempManager(const std::string &dir,
+	inline ImportTempManager(Executor &executor, const std::string &dir,
 		std::function<void()> callback) :
-	tmp_dir(dir + "/tmp"), worker(callback)
+	tmp_dir(dir + "/tmp"), worker(executor, priority::bulk, callback)
 	{}
 
 	// Import a new video to a temporary directory
@@ -0,0 +1,106 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * This Source Code Form is "Incompatible With Secondary Licenses", as
+ * defined by the Mozilla Public License, v. 2.0. */
+
+#ifndef ACTIONPLUS_LIB__DETAIL__PARALLEL_FOR_HPP_
+#define ACTIONPLUS_LIB__DETAIL__PARALLEL_FOR_HPP_
+
+#include "worker.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+namespace actionplus_lib
+{
+namespace detail
+{
+
+// Shared by a parallel_for() and its helper tasks
+struct ParallelForState
+{
+	std::size_t count;
+	// Only called for an i that is taken, so never after parallel_for()
+	// returns
+	const std::function<void(std::size_t i)> *func;
+	std::atomic<std::size_t> next;
+
+	std::mutex mtx;
+	std::condition_variable cv;
+	// Guarded by mtx
+	std::size_t done;
+
+	// false if all i were taken
+	inline bool run_one()
+	{
+		std::size_t i = next++;
+		if (i >= count)
+			return false;
+
+		(*func)(i);
+
+		std::lock_guard<std::mutex> lk(mtx);
+		if (++done == count)
+			cv.notify_all();
+		return true;
+	}
+};
+
+// A helper task runs one item and adds itself again while items are left,
+// so it never holds a thread of the executor for more than one item
+inline void parallel_for_help(Worker &worker,
+	std::shared_ptr<ParallelForState> state)
+{
+	worker.add([&worker, state] {
+		if (state->run_one() && state->next < state->count) {
+			try {
+				parallel_for_help(worker, state);
+			} catch (...) {
+				// The other threads take the rest
+			}
+		}
+	});
+}
+
+// Calls func(i) for every i in [0, count) on the calling thread and on up to
+// `helpers` tasks of worker, one item per task. Only the items that are taken
+// are waited for, so this never waits for a thread of the executor to free
+// up. func must not throw.
+inline void parallel_for(Worker &worker, std::size_t helpers,
+	std::size_t count, const std::function<void(std::size_t i)> &func)
+{
+	auto state = std::make_shared<ParallelForState>();
+	state->count = count;
+	state->func = &func;
+	state->next = 0;
+	state->done = 0;
+
+	helpers = std::min(helpers, count > 0 ? count - 1 : 0);
+	for (std::size_t t = 0; t < helpers; t++) {
+		try {
+			parallel_for_help(worker, state);
+		} catch (...) {
+			// Fewer helpers then
+			break;
+		}
+	}
+
+	while (state->run_one()) {}
+
+	std::unique_lock<std::mutex> lk(state->mtx);
+	state->cv.wait(lk, [&state] {
+		return state->done == state->count;
+	});
+}
+
+}
+}
+
+#endif
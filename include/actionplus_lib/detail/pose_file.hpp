@@ -0,0 +1,167 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * This Source Code Form is "Incompatible With Secondary Licenses", as
+ * defined by the Mozilla Public License, v. 2.0. */
+
+#ifndef ACTIONPLUS_LIB__DETAIL__POSE_FILE_HPP_
+#define ACTIONPLUS_LIB__DETAIL__POSE_FILE_HPP_
+
+#include "byte_order.hpp"
+#include "file_io.hpp"
+#include "pose_track.hpp"
+#include "sync_file.hpp"
+
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+namespace actionplus_lib
+{
+namespace detail
+{
+
+// The PoseTrack of an analysis, converted from action.act so that it can be
+// loaded without libaction.
+//
+// Layout (little-endian):
+//   0   magic "APPOSES" and a zero
+//   8   u32 version
+//   12  u32 parts per frame
+//   16  u64 frames
+//   24  u64 size, 32 u64 modification time in nanoseconds and 40 u64 inode
+//       of the analysis file it was converted from (a FileStamp)
+//   48  reserved up to 64
+//   then the records of the frames, as in PoseTrack
+//
+// The file is memory mapped instead of read and deserialized, but it is not
+// scored in place. libaction only scores libaction::Human objects, so a
+// Human is still built for each frame of a track that does not keep them
+// (see PoseTrack), and libaction allocates the scores of each frame.
+namespace pose_file
+{
+
+const char magic[8]{'A', 'P', 'P', 'O', 'S', 'E', 'S', '\0'};
+const std::uint32_t version = 2;
+const std::size_t header_size = 64;
+
+}
+
+// Writes the pose file of track to tmp_file and moves it to file
+inline void write_pose_file(const std::string &file,
+	const std::string &tmp_file, const PoseTrack &track,
+	const FileStamp &source)
+{
+	FILE *f = std::fopen(tmp_file.c_str(), "wb");
+	if (!f)
+		throw std::runtime_error("failed to open file");
+
+	std::uint8_t header[pose_file::header_size]{};
+	std::memcpy(header, pose_file::magic, sizeof(pose_file::magic));
+	byte_order::put_u32(header + 8, pose_file::version);
+	byte_order::put_u32(header + 12, static_cast<std::uint32_t>(
+		PoseTrack::parts));
+	byte_order::put_u64(header + 16, track.frames());
+	byte_order::put_u64(header + 24, source.size);
+	byte_order::put_u64(header + 32, source.mtime_ns);
+	byte_order::put_u64(header + 40, source.inode);
+
+	std::size_t size = track.frames() * PoseTrack::record_size;
+	if (std::fwrite(header, 1, sizeof(header), f) < sizeof(header) ||
+			std::fwrite(track.data(), 1, size, f) < size) {
+		std::fclose(f);
+		try {
+			boost::filesystem::remove(tmp_file);
+		} catch (...) {}
+		throw std::runtime_error("failed to write file");
+	}
+
+	std::fclose(f);
+
+	sync_file(tmp_file);
+
+	try {
+		boost::filesystem::rename(tmp_file, file);
+	} catch (...) {
+		try {
+			boost::filesystem::remove(tmp_file);
+		} catch (...) {}
+		throw;
+	}
+}
+
+// A memory mapped pose file
+class PoseFile
+{
+public:
+	// Throws if the file is missing, incomplete or was converted from another
+	// version of the analysis file
+	inline PoseFile(const std::string &file, const FileStamp &source) :
+	mapping(file.c_str(), boost::interprocess::read_only),
+	region(mapping, boost::interprocess::read_only)
+	{
+		data = static_cast<const std::uint8_t *>(region.get_address());
+		auto size = region.get_size();
+
+		if (size < pose_file::header_size ||
+				std::memcmp(data, pose_file::magic,
+					sizeof(pose_file::magic)) != 0 ||
+				byte_order::get_u32(data + 8) != pose_file::version ||
+				byte_order::get_u32(data + 12) != PoseTrack::parts ||
+				byte_order::get_u64(data + 24) != source.size ||
+				byte_order::get_u64(data + 32) != source.mtime_ns ||
+				byte_order::get_u64(data + 40) != source.inode)
+			throw std::runtime_error("invalid pose file");
+
+		auto frame_count = byte_order::get_u64(data + 16);
+		if (frame_count > max_file_frames ||
+				frame_count > (size - pose_file::header_size) /
+					PoseTrack::record_size)
+			throw std::runtime_error("invalid pose file");
+		total = static_cast<std::size_t>(frame_count);
+	}
+
+	PoseFile(const PoseFile &) = delete;
+	PoseFile &operator=(const PoseFile &) = delete;
+
+	inline std::size_t frames() const
+	{
+		return total;
+	}
+
+	// The records of all frames
+	inline const std::uint8_t *records() const
+	{
+		return data + pose_file::header_size;
+	}
+
+private:
+	boost::interprocess::file_mapping mapping;
+	boost::interprocess::mapped_region region;
+
+	const std::uint8_t *data{};
+	std::size_t total{0};
+};
+
+// A PoseTrack that reads the frames from the mapped pose file, which stays
+// mapped as long as the track is used
+inline std::shared_ptr<PoseTrack> map_pose_file(const std::string &file,
+	const FileStamp &source)
+{
+	auto mapped = std::make_shared<PoseFile>(file, source);
+	return std::make_shared<PoseTrack>(mapped->records(), mapped->frames(),
+		mapped);
+}
+
+}
+}
+
+#endif
@@ -0,0 +1,241 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * This Source Code Form is "Incompatible With Secondary Licenses", as
+ * defined by the Mozilla Public License, v. 2.0. */
+
+#ifndef ACTIONPLUS_LIB__DETAIL__POSE_TRACK_HPP_
+#define ACTIONPLUS_LIB__DETAIL__POSE_TRACK_HPP_
+
+#include "byte_order.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <libaction/body_part.hpp>
+#include <libaction/human.hpp>
+#include <list>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace actionplus_lib
+{
+namespace detail
+{
+
+// Human 0 of every frame of a video, as fixed size records built once on
+// load, or mapped from a pose file. Scoring scans two tracks side by side
+// instead of walking lists of hash tables.
+//
+// libaction scores libaction::Human objects. Tracks that are scored again
+// and again, like cached standards, keep the one of every frame next to the
+// records, and others build the one of a frame when it is scored.
+class PoseTrack
+{
+public:
+	using PartIndex = libaction::BodyPart::PartIndex;
+
+	static constexpr std::size_t parts = static_cast<std::size_t>(PartIndex::end);
+
+	// Bytes of a frame (little-endian):
+	//   0   u32 bit p set if part p is in the frame
+	//   4   per part: f32 x, f32 y, f32 score (zeros if not in the frame)
+	static constexpr std::size_t record_size = 4 + parts * 12;
+
+	struct Point
+	{
+		float x;
+		float y;
+		float score;
+	};
+
+	inline PoseTrack() = default;
+
+	// From an analysis as stored in action.act
+	inline explicit PoseTrack(
+		const std::list<std::unordered_map<std::size_t, libaction::Human>>
+			&action)
+	{
+		reserve(action.size());
+		append(action);
+	}
+
+	// From an analysis as reported to the user
+	inline explicit PoseTrack(
+		const std::list<std::unique_ptr<libaction::Human>> &humans)
+	{
+		reserve(humans.size());
+		for (auto &human: humans)
+			push_back(human.get());
+	}
+
+	// A view of frame_count records at data, which owner keeps valid
+	inline PoseTrack(const std::uint8_t *data, std::size_t frame_count,
+		std::shared_ptr<const void> owner) :
+	view(data), total(frame_count), view_owner(std::move(owner))
+	{}
+
+	PoseTrack(const PoseTrack &) = delete;
+	PoseTrack &operator=(const PoseTrack &) = delete;
+
+	// Room for frames in total, when the frames are appended in chunks
+	inline void reserve(std::size_t frames)
+	{
+		records.reserve(frames * record_size);
+	}
+
+	// Frames of an analysis after those already in the track
+	inline void append(
+		const std::list<std::unordered_map<std::size_t, libaction::Human>>
+			&action)
+	{
+		for (auto &frame: action) {
+			auto it = frame.find(0);
+			push_back(it != frame.end() ? &it->second : nullptr);
+		}
+	}
+
+	inline std::size_t frames() const
+	{
+		return total;
+	}
+
+	// Build the human of every frame once, so that human() only returns it.
+	// Must be called before the track is shared between threads.
+	inline void keep_humans()
+	{
+		if (humans_kept)
+			return;
+
+		kept.reserve(total);
+		for (std::size_t i = 0; i < total; i++) {
+			kept.push_back(build_human(i));
+			if (kept.back())
+				kept_bytes += human_bytes(*kept.back());
+		}
+		humans_kept = true;
+	}
+
+	// The human of frame for libaction, or nullptr if there is none. Unless
+	// the humans are kept, it is built into built, which must outlive its
+	// use.
+	inline const libaction::Human *human(std::size_t frame,
+		std::unique_ptr<libaction::Human> &built) const
+	{
+		if (humans_kept)
+			return kept[frame].get();
+
+		built = build_human(frame);
+		return built.get();
+	}
+
+	// Bit i is set if part i is in frame
+	inline std::uint32_t part_mask(std::size_t frame) const
+	{
+		return byte_order::get_u32(record(frame));
+	}
+
+	// Zeros if the part is not in frame
+	inline Point point(std::size_t frame, PartIndex part) const
+	{
+		auto *src = record(frame) + 4 + static_cast<std::size_t>(part) * 12;
+		return Point{byte_order::get_f32(src), byte_order::get_f32(src + 4),
+			byte_order::get_f32(src + 8)};
+	}
+
+	// The records of all frames
+	inline const std::uint8_t *data() const
+	{
+		return view ? view : records.data();
+	}
+
+	// Heap usage, or the mapped size of a view, and about that of the kept
+	// humans
+	inline std::size_t bytes() const
+	{
+		return (view ? total * record_size : records.capacity()) +
+			kept.capacity() * sizeof(kept[0]) + kept_bytes;
+	}
+
+private:
+	// Built records, unless this is a view
+	std::vector<std::uint8_t> records{};
+
+	const std::uint8_t *view{};
+	std::size_t total{0};
+	std::shared_ptr<const void> view_owner{};
+
+	bool humans_kept{false};
+	std::vector<std::unique_ptr<const libaction::Human>> kept{};
+	std::size_t kept_bytes{0};
+
+	inline const std::uint8_t *record(std::size_t frame) const
+	{
+		return data() + frame * record_size;
+	}
+
+	inline std::unique_ptr<libaction::Human> build_human(
+		std::size_t frame) const
+	{
+		auto mask = part_mask(frame);
+		if (mask == 0)
+			return nullptr;
+
+		std::unordered_map<PartIndex, libaction::BodyPart> body_parts;
+		for (std::size_t i = 0; i < parts; i++) {
+			if (mask & (static_cast<std::uint32_t>(1) << i)) {
+				auto part = static_cast<PartIndex>(i);
+				auto p = point(frame, part);
+				body_parts.emplace(part, libaction::BodyPart(part, p.x, p.y,
+					p.score));
+			}
+		}
+
+		return std::unique_ptr<libaction::Human>(
+			new libaction::Human(std::move(body_parts)));
+	}
+
+	// The object, its buckets and its nodes of one pointer and the value
+	static inline std::size_t human_bytes(const libaction::Human &human)
+	{
+		auto &body_parts = human.body_parts();
+		return sizeof(libaction::Human) +
+			body_parts.bucket_count() * sizeof(void *) +
+			body_parts.size() * (sizeof(void *) +
+				sizeof(std::pair<const PartIndex, libaction::BodyPart>));
+	}
+
+	inline void push_back(const libaction::Human *human)
+	{
+		if (view || humans_kept)
+			throw std::runtime_error("cannot append to this track");
+
+		records.resize(records.size() + record_size, 0);
+		auto *dst = &records[records.size() - record_size];
+
+		std::uint32_t mask = 0;
+		if (human) {
+			for (auto &part: human->body_parts()) {
+				auto index = static_cast<std::size_t>(part.second.part_index());
+				if (index >= parts)
+					continue;
+				auto *point = dst + 4 + index * 12;
+				byte_order::put_f32(point, part.second.x());
+				byte_order::put_f32(point + 4, part.second.y());
+				byte_order::put_f32(point + 8, part.second.score());
+				mask |= static_cast<std::uint32_t>(1) << index;
+			}
+		}
+		byte_order::put_u32(dst, mask);
+
+		total++;
+	}
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,191 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * This Source Code Form is "Incompatible With Secondary Licenses", as
+ * defined by the Mozilla Public License, v. 2.0. */
+
+#ifndef ACTIONPLUS_LIB__DETAIL__SCORE_MATRIX_HPP_
+#define ACTIONPLUS_LIB__DETAIL__SCORE_MATRIX_HPP_
+
+#include "../action_scores.hpp"
+#include "pose_track.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <libaction/body_part.hpp>
+#include <libaction/human.hpp>
+#include <libaction/still/single/score.hpp>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+namespace actionplus_lib
+{
+namespace detail
+{
+
+using PairScores = std::map<std::pair<libaction::BodyPart::PartIndex,
+	libaction::BodyPart::PartIndex>, std::uint8_t>;
+
+// Column of a pair of parts, in either order, in a ScoreMatrix, or -1
+inline int score_column(libaction::BodyPart::PartIndex first,
+	libaction::BodyPart::PartIndex second)
+{
+	using Columns = std::array<std::array<std::int8_t, PoseTrack::parts>,
+		PoseTrack::parts>;
+
+	static const Columns columns = [] {
+		Columns result;
+		for (auto &row: result)
+			row.fill(-1);
+		for (std::size_t i = 0; i < ScorePairs::count; i++) {
+			auto a = static_cast<std::size_t>(ScorePairs::pairs[i].first);
+			auto b = static_cast<std::size_t>(ScorePairs::pairs[i].second);
+			result[a][b] = static_cast<std::int8_t>(i);
+			result[b][a] = static_cast<std::int8_t>(i);
+		}
+		return result;
+	}();
+
+	auto a = static_cast<std::size_t>(first);
+	auto b = static_cast<std::size_t>(second);
+	if (a >= PoseTrack::parts || b >= PoseTrack::parts)
+		return -1;
+	return columns[a][b];
+}
+
+// Scores human against standard as libaction does
+inline std::unique_ptr<PairScores> score_pairs(const libaction::Human &human,
+	const libaction::Human &standard)
+{
+	auto frame_scores = libaction::still::single::score::score(human,
+		standard);
+	if (!frame_scores)
+		throw std::runtime_error("failed to score");
+	return frame_scores;
+}
+
+// Running sums of the scores of frames, from which score() and the others
+// take their means
+struct ScoreSums
+{
+	std::map<PairScores::key_type, std::uint64_t> part_sums{};
+	std::map<PairScores::key_type, std::uint32_t> part_counts{};
+	std::uint64_t frame_sum{0};
+	std::uint32_t frame_count{0};
+
+	inline void add(const PairScores &frame_scores)
+	{
+		std::uint32_t sum = 0;
+		for (auto &score: frame_scores) {
+			sum += score.second;
+			part_sums[score.first] += score.second;
+			part_counts[score.first]++;
+		}
+		if (!frame_scores.empty()) {
+			frame_sum += sum / frame_scores.size();
+			frame_count++;
+		}
+	}
+
+	// Mean score of each pair over the frames it was scored in
+	inline std::unique_ptr<PairScores> part_means() const
+	{
+		auto means = std::unique_ptr<PairScores>(new PairScores());
+		for (auto &sum: part_sums) {
+			(*means)[sum.first] = static_cast<std::uint8_t>(
+				sum.second / part_counts.at(sum.first));
+		}
+		return means;
+	}
+
+	// Mean over the frames with any score of the frame means
+	inline std::uint8_t mean() const
+	{
+		return static_cast<std::uint8_t>(frame_count != 0 ?
+			frame_sum / frame_count : 0);
+	}
+};
+
+// score_pairs(), and writes the pairs that are in ScorePairs into one row
+// of a ScoreMatrix, which must be zeroed. Other pairs are only in the
+// result.
+inline std::unique_ptr<PairScores> score_frame(const libaction::Human &human,
+	const libaction::Human &standard, std::uint8_t *scores,
+	std::uint8_t *scored)
+{
+	auto frame_scores = score_pairs(human, standard);
+
+	for (auto &score: *frame_scores) {
+		auto column = score_column(score.first.first, score.first.second);
+		if (column < 0)
+			continue;
+		scores[column] = score.second;
+		scored[column] = 1;
+	}
+
+	return frame_scores;
+}
+
+inline std::unique_ptr<ScoreMatrix> compute_scores(const PoseTrack &sample,
+	const PoseTrack &standard)
+{
+	auto matrix = std::unique_ptr<ScoreMatrix>(new ScoreMatrix());
+	matrix->frames = std::min(sample.frames(), standard.frames());
+	matrix->stride = ScorePairs::count;
+	matrix->scores.resize(matrix->frames * matrix->stride);
+	matrix->scored.resize(matrix->frames * matrix->stride);
+
+	ScoreSums sums;
+
+	for (std::size_t i = 0; i < matrix->frames; i++) {
+		std::unique_ptr<libaction::Human> built1, built2;
+		auto human1 = sample.human(i, built1);
+		auto human2 = standard.human(i, built2);
+		if (!human1 || !human2)
+			continue;
+
+		auto row = i * matrix->stride;
+		sums.add(*score_frame(*human1, *human2, &matrix->scores[row],
+			&matrix->scored[row]));
+	}
+
+	// Both orders of a pair are one column
+	std::array<std::uint64_t, ScorePairs::count> part_sums{};
+	std::array<std::uint32_t, ScorePairs::count> part_counts{};
+	for (auto &sum: sums.part_sums) {
+		auto count = sums.part_counts.at(sum.first);
+		auto column = score_column(sum.first.first, sum.first.second);
+		if (column < 0) {
+			matrix->unlisted_scores += count;
+			continue;
+		}
+		part_sums[column] += sum.second;
+		part_counts[column] += count;
+	}
+
+	matrix->part_means.resize(ScorePairs::count);
+	matrix->part_scored.resize(ScorePairs::count);
+	for (std::size_t p = 0; p < ScorePairs::count; p++) {
+		if (part_counts[p] != 0) {
+			matrix->part_means[p] = static_cast<std::uint8_t>(
+				part_sums[p] / part_counts[p]);
+			matrix->part_scored[p] = 1;
+		}
+	}
+
+	// Over all pairs libaction scores, as in score(), including those
+	// without a column
+	matrix->mean = sums.mean();
+
+	return matrix;
+}
+
+}
+}
+
+#endif
@@ -34,12 +34,12 @@ namespace detail
 class StorageManager
 {
 public:
-	inline StorageManager(const std::string &dir,
+	inline StorageManager(Executor &executor, const std::string &dir,
 		std::function<void()> read_callback,
-		std::function<void()> write_callback) :
+		std::function<void()> write_callback, std::size_t read_threads = 1) :
 	root_dir(dir), storage_dir(dir + "/storage"), tmp_dir(dir + "/tmp"),
-	read_worker(read_callback),
-	write_worker(write_callback)
+	read_worker(executor, priority::read, read_callback, read_threads),
+	write_worker(executor, priority::write, write_callback)
 	{}
 
 	// List all items
@@ -189,12 +189,17 @@ public:
 	}
 
 	// Remove an item
-	inline void remove(const std::string &id)
+	// done is called once the item is moved to the trash
+	inline void remove(const std::string &id, std::function<void()> done)
 	{
-		write_worker.add([this, id] {
+		write_worker.add([this, id, done] {
 			std::string uuid = boost::uuids::to_string(uuid_gen());
 			boost::filesystem::rename(storage_dir + "/" + id,
 				root_dir + "/trash/" + uuid);
+
+			try {
+				done();
+			} catch (...) {}
 		});
 	}
 
@@ -8,6 +8,8 @@
 #ifndef ACTIONPLUS_LIB__DETAIL__VIDEO_ANALYZER_HPP_
 #define ACTIONPLUS_LIB__DETAIL__VIDEO_ANALYZER_HPP_
 
+#include "core_budget.hpp"
+#include "estimator_pool.hpp"
 #include "video_buffer.hpp"
 
 #include <algorithm>
@@ -21,6 +23,7 @@
 #include <mutex>
 #include <string>
 #include <thread>
+#include <vector>
 
 namespace actionplus_lib
 {
@@ -30,10 +33,16 @@ namespace detail
 class VideoAnalyzer
 {
 public:
-	inline VideoAnalyzer(const std::string &video,
-		const std::vector<uint8_t> &graph,
-		// graph must be kept throughout lifetime
-		std::size_t graph_height, std::size_t graph_width)
+	// Decoder threads for one analysis. A frame takes much longer to estimate
+	// than to decode, so a few threads keep up with the estimators.
+	static inline unsigned decode_threads(std::size_t estimators)
+	{
+		return static_cast<unsigned>(std::min(std::max(estimators / 8,
+			static_cast<std::size_t>(1)), static_cast<std::size_t>(4)));
+	}
+
+	// Number of estimator threads available to all analyses together
+	static inline std::size_t default_estimators()
 	{
 		unsigned int estimators = std::thread::hardware_concurrency();
 
@@ -50,15 +59,29 @@ public:
 		// One thread for video buffering
 		estimators--;
 
-		// TODO: validate that buffering `estimators` number of frames is optimal
-		video_buffer = std::unique_ptr<VideoBuffer>(new VideoBuffer(video,
-			graph_height, graph_width, estimators));
+		return estimators;
+	}
 
-		for (unsigned int i = 0; i < estimators; i++) {
-			using type = libaction::still::single::Estimator<float>;
-			still_estimators.push_back(std::unique_ptr<type>(new type(
-				graph.data(), graph.size(), 1, graph_height, graph_width, 3)));
-		}
+	// Only frames from first_frame on can be analyzed. Frames are cached in
+	// cache_file if it is not empty (see VideoBuffer).
+	inline VideoAnalyzer(const std::string &video,
+		std::size_t graph_height, std::size_t graph_width,
+		// pool and budget must be kept throughout lifetime
+		EstimatorPool &pool, CoreBudget &budget,
+		std::size_t first_frame = 0,
+		const std::string &cache_file = "",
+		const std::string &tmp_cache_file = "") :
+	estimator_pool(pool),
+	core_lease(budget)
+	{
+		// Start with a frame per estimator of the largest share this analysis
+		// can get. VideoBuffer adapts the depth from there.
+		// Analyzing a frame reads the frames around it
+		std::size_t first_buffered = first_frame > fuzz_range ?
+			first_frame - fuzz_range : 0;
+		video_buffer = std::unique_ptr<VideoBuffer>(new VideoBuffer(video,
+			graph_height, graph_width, budget.cores(), first_buffered,
+			cache_file, tmp_cache_file, decode_threads(budget.cores())));
 	}
 
 	inline std::size_t frames() const
@@ -66,15 +89,17 @@ public:
 		return video_buffer->frames();
 	}
 
+	inline VideoBufferStats buffer_stats()
+	{
+		return video_buffer->stats();
+	}
+
 	inline std::unique_ptr<std::unordered_map<std::size_t, libaction::Human>>
 	analyze(std::size_t frame)
 	{
-		const std::size_t fuzz_range = 7;
-
-		std::vector<libaction::still::single::Estimator<float> *>
-			still_estimator_ptrs;
-		for (auto &est: still_estimators)
-			still_estimator_ptrs.push_back(est.get());
+		// The share changes when other analyses start or finish
+		auto lease = estimator_pool.lease(core_lease.share());
+		auto still_estimator_ptrs = lease->estimators();
 
 		std::function<std::shared_ptr<boost::multi_array<uint8_t, 3>>
 			(std::size_t pos, bool last_image_access)> cb{
@@ -89,9 +114,12 @@ public:
 	}
 
 private:
+	const std::size_t fuzz_range{7};
+
+	EstimatorPool &estimator_pool;
+	CoreBudget::Lease core_lease;
+
 	std::unique_ptr<VideoBuffer> video_buffer{};
-	std::vector<std::unique_ptr<libaction::still::single::Estimator<float>>>
-		still_estimators{};
 	libaction::motion::single::Estimator motion_estimator{};
 
 	inline std::shared_ptr<boost::multi_array<uint8_t, 3>> estimator_callback(
@@ -8,17 +8,25 @@
 #ifndef ACTIONPLUS_LIB__DETAIL__VIDEO_BUFFER_HPP_
 #define ACTIONPLUS_LIB__DETAIL__VIDEO_BUFFER_HPP_
 
+#include "../action_stats.hpp"
+#include "frame_cache.hpp"
+#include "frame_pool.hpp"
 #include "video_reader.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <boost/multi_array.hpp>
+#include <chrono>
 #include <condition_variable>
 #include <cstddef>
 #include <cstdint>
 #include <memory>
 #include <mutex>
+#include <set>
 #include <string>
 #include <thread>
 #include <unordered_map>
+#include <vector>
 
 namespace actionplus_lib
 {
@@ -28,43 +36,118 @@ namespace detail
 class VideoBuffer
 {
 public:
+	// Up to batch_frames frames are decoded before they are handed to the
+	// readers together. A batch ends early once a reader is waiting for a
+	// frame that is already decoded.
+	//
+	// The number of frames decoded ahead of the readers starts at
+	// buffer_frames and adapts between 1 and 4 * buffer_frames: it grows
+	// when a reader has to wait for a frame, and shrinks when the decoder has
+	// been held back for buffer_frames times in a row without any reader
+	// waiting. Frames decoded ahead never take more than max_ahead_bytes.
+	//
+	// If cache_file is not empty, frames are read from it when it is a valid
+	// frame cache for this scale. Otherwise the video is decoded and, if
+	// tmp_cache_file is not empty too, the frames are written to the cache
+	// on the way.
+	//
+	// Frames before first_frame are decoded but not kept, and cannot be read.
 	inline VideoBuffer(const std::string &video,
 		std::size_t scale_height, std::size_t scale_width,
-		std::size_t buffer_frames) :
-	buffer(buffer_frames),
-	reader(video, scale_height, scale_width)
+		std::size_t buffer_frames, std::size_t first_frame,
+		const std::string &cache_file, const std::string &tmp_cache_file,
+		unsigned decode_threads = 1,
+		std::size_t batch_frames = 8,
+		std::size_t max_ahead_bytes = 256 * 1024 * 1024) :
+	buffer(std::max(buffer_frames, static_cast<std::size_t>(1))),
+	max_batch(std::max(batch_frames, static_cast<std::size_t>(1))),
+	max_bytes(max_ahead_bytes),
+	first(first_frame),
+	// Frames held by readers plus a decoded batch, and one for rotation
+	frame_pool(std::make_shared<FramePool>(4 * buffer + max_batch + 1)),
+	slot_cvs(4 * buffer),
+	// Start decoding towards the first frame right away
+	target_next(first_frame),
+	depth(buffer)
 	{
+		if (!cache_file.empty()) {
+			try {
+				cache_reader = std::unique_ptr<FrameCacheReader>(
+					new FrameCacheReader(cache_file, scale_height, scale_width,
+						frame_pool));
+			} catch (...) {}
+		}
+
+		if (!cache_reader) {
+			video_reader = std::unique_ptr<VideoReader>(new VideoReader(video,
+				scale_height, scale_width, frame_pool, true, decode_threads));
+
+			if (!cache_file.empty() && !tmp_cache_file.empty()) {
+				try {
+					cache_writer = std::unique_ptr<FrameCacheWriter>(
+						new FrameCacheWriter(cache_file, tmp_cache_file,
+							video_reader->frames(), scale_height, scale_width,
+							video_reader->frame_height(),
+							video_reader->frame_width()));
+				} catch (...) {}
+			}
+		}
+
+		// Known before the first frame is decoded, so that the first
+		// batches stay within max_bytes too
+		frame_bytes = 3 * (cache_reader ?
+			cache_reader->frame_height() * cache_reader->frame_width() :
+			video_reader->frame_height() * video_reader->frame_width());
+		depth = std::min(depth, max_depth());
+
 		thread = std::thread(std::bind(&VideoBuffer::runner, this));
 	}
 
 	inline ~VideoBuffer()
 	{
 		{
-			std::lock_guard<std::mutex> lk(data_mtx);
+			auto lk = lock_data();
 			stop = true;
 		}
-		cv.notify_all();
+		runner_cv.notify_all();
 		thread.join();
 	}
 
 	inline std::size_t frames() const
 	{
-		return reader.frames();
+		return source_frames();
 	}
 
 	inline std::shared_ptr<boost::multi_array<uint8_t, 3>> read(std::size_t index)
 	{
-		if (index >= reader.frames())
-			throw std::runtime_error("index >= reader.frames()");
+		if (index >= source_frames())
+			throw std::runtime_error("index >= frames()");
 
-		std::unique_lock<std::mutex> lk(data_mtx);
+		auto lk = lock_data();
 
 		if (index >= target_next) {
 			target_next = index + 1;
-			cv.notify_all();
+			runner_cv.notify_one();
 		}
 
-		cv.wait(lk, [this, index] {return next > index;});
+		if (next <= index) {
+			// Decoding is behind. Look further ahead from now on.
+			reader_stalls++;
+			calm_waits = 0;
+			depth = std::min(depth + 1, max_depth());
+			runner_cv.notify_one();
+
+			auto waiting = waiting_readers.insert(index);
+			lowest_waiting = *waiting_readers.begin();
+
+			auto start = std::chrono::steady_clock::now();
+			slot_cv(index).wait(lk, [this, index] {return next > index;});
+			reader_wait_ns += elapsed_ns(start);
+
+			waiting_readers.erase(waiting);
+			lowest_waiting = waiting_readers.empty() ? SIZE_MAX :
+				*waiting_readers.begin();
+		}
 
 		auto it = data.find(index);
 		if (it == data.end())
@@ -74,37 +157,190 @@ public:
 
 	inline void remove(std::size_t index)
 	{
-		std::lock_guard<std::mutex> lk(data_mtx);
+		auto lk = lock_data();
 		data.erase(index);
 	}
 
+	inline VideoBufferStats stats()
+	{
+		auto lk = lock_data();
+
+		VideoBufferStats result;
+		result.depth = depth;
+		result.max_depth = max_depth();
+		result.frame_bytes = frame_bytes;
+		result.buffered_frames = data.size();
+		result.reader_stalls = reader_stalls;
+		result.reader_wait_ns = reader_wait_ns;
+		result.decoder_stalls = decoder_stalls;
+		result.decoder_wait_ns = decoder_wait_ns;
+		result.lock_contentions = lock_contentions;
+		return result;
+	}
+
 private:
 	const std::size_t buffer;
+	const std::size_t max_batch;
+	const std::size_t max_bytes;
+	const std::size_t first;
+
+	std::shared_ptr<FramePool> frame_pool;
 
 	std::mutex data_mtx{};
-	std::condition_variable cv{};
+	// Times data_mtx was already locked when trying to lock it
+	std::atomic<std::uint64_t> lock_contentions{0};
+
+	// Readers waiting for frame i wait on slot_cvs[i % slot_cvs.size()], so
+	// publishing a frame only wakes the readers of that frame (and of the
+	// few frames sharing its slot)
+	std::vector<std::condition_variable> slot_cvs;
+	// The runner waits on this one
+	std::condition_variable runner_cv{};
 
 	bool stop{false};
-	std::size_t target_next{0};
+	// Written with data_mtx held, but also polled by runner() while decoding
+	std::atomic<std::size_t> target_next;
 	std::size_t next{0};
 	std::unordered_map<std::size_t,
 		std::shared_ptr<boost::multi_array<uint8_t, 3>>> data{};
 
-	VideoReader reader;
+	// Frames that readers are waiting for, and the lowest of them (SIZE_MAX
+	// if none), which runner() polls while decoding
+	std::multiset<std::size_t> waiting_readers{};
+	std::atomic<std::size_t> lowest_waiting{SIZE_MAX};
+
+	// Frames to decode ahead of target_next
+	std::size_t depth;
+	// Size of the last decoded frame
+	std::size_t frame_bytes{0};
+	// Decoder waits since the last reader stall
+	std::size_t calm_waits{0};
+
+	std::uint64_t reader_stalls{0};
+	std::uint64_t reader_wait_ns{0};
+	std::uint64_t decoder_stalls{0};
+	std::uint64_t decoder_wait_ns{0};
+
+	// Frames come from the cache if it is valid, otherwise from the video
+	std::unique_ptr<FrameCacheReader> cache_reader{};
+	std::unique_ptr<VideoReader> video_reader{};
+	// Fills the cache while the video is decoded
+	std::unique_ptr<FrameCacheWriter> cache_writer{};
 
 	std::thread thread{};
 
+	inline std::size_t source_frames() const
+	{
+		return cache_reader ? cache_reader->frames() : video_reader->frames();
+	}
+
+	// The following are only used by runner()
+
+	inline std::size_t source_next()
+	{
+		return cache_reader ? cache_reader->next_index() :
+			video_reader->next_index();
+	}
+
+	inline std::shared_ptr<boost::multi_array<uint8_t, 3>> source_read(
+		std::size_t index)
+	{
+		return cache_reader ? cache_reader->read(index) :
+			video_reader->read(index);
+	}
+
+	inline std::shared_ptr<boost::multi_array<uint8_t, 3>> source_take(
+		std::size_t index)
+	{
+		return cache_reader ? cache_reader->take(index) :
+			video_reader->take(index);
+	}
+
+	inline void write_cache(std::size_t begin, std::size_t end)
+	{
+		if (!cache_writer)
+			return;
+
+		try {
+			for (std::size_t i = begin; i < end; i++)
+				cache_writer->write(*source_read(i));
+
+			if (cache_writer->written() == source_frames()) {
+				cache_writer->finish();
+				cache_writer.reset();
+			}
+		} catch (...) {
+			// The cache is optional
+			cache_writer.reset();
+		}
+	}
+
+	static inline std::uint64_t elapsed_ns(
+		std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - start).count();
+	}
+
+	inline std::unique_lock<std::mutex> lock_data()
+	{
+		std::unique_lock<std::mutex> lk(data_mtx, std::try_to_lock);
+		if (!lk.owns_lock()) {
+			lock_contentions++;
+			lk.lock();
+		}
+		return lk;
+	}
+
+	inline std::condition_variable &slot_cv(std::size_t index)
+	{
+		return slot_cvs[index % slot_cvs.size()];
+	}
+
+	// data_mtx must be held
+	inline std::size_t max_depth() const
+	{
+		std::size_t result = 4 * buffer;
+		if (frame_bytes != 0)
+			result = std::min(result, max_bytes / frame_bytes);
+		return std::max(result, static_cast<std::size_t>(1));
+	}
+
+	// Frames to decode ahead of target_next, within max_bytes. data_mtx must
+	// be held.
+	inline std::size_t ahead() const
+	{
+		return std::min(depth, max_depth());
+	}
+
 	inline void runner()
 	{
-		std::unique_lock<std::mutex> lk(data_mtx);
+		auto lk = lock_data();
 
 		while (true) {
-			cv.wait(lk, [this] {
+			if (!stop && source_next() < source_frames() &&
+					target_next + ahead() <= source_next()) {
+				// Far enough ahead. Look less far ahead if this keeps
+				// happening while no reader has to wait.
+				decoder_stalls++;
+				if (++calm_waits >= buffer) {
+					calm_waits = 0;
+					depth = std::max(depth - 1, static_cast<std::size_t>(1));
+				}
+
+				auto start = std::chrono::steady_clock::now();
+				runner_cv.wait(lk, [this] {
+					return stop || target_next + ahead() > source_next();
+				});
+				decoder_wait_ns += elapsed_ns(start);
+			}
+
+			runner_cv.wait(lk, [this] {
 				if (stop)
 					return true;
-				if (reader.next_index() >= reader.frames())
+				if (source_next() >= source_frames())
 					return false;
-				if (target_next + buffer > reader.next_index())
+				if (target_next + ahead() > source_next())
 					return true;
 				return false;
 			});
@@ -112,22 +348,37 @@ private:
 			if (stop)
 				return;
 
-			auto prev = reader.next_index();
+			auto prev = source_next();
+			auto end = std::min(std::min(prev + max_batch,
+				target_next + ahead()), source_frames());
 			lk.unlock();
 			try {
-				reader.read(prev);
+				do {
+					source_read(source_next());
+				} while (source_next() < end &&
+					lowest_waiting >= source_next());
 			} catch (...) {}
-			lk.lock();
+			write_cache(prev, source_next());
+			lk = lock_data();
 
-			for (std::size_t i = prev; i < reader.next_index(); i++) {
+			for (std::size_t i = prev; i < source_next(); i++) {
 				try {
-					data[i] = reader.read(i);
-					reader.remove(i);
+					auto image = source_take(i);
+					frame_bytes = image->num_elements();
+					depth = std::min(depth, max_depth());
+					if (i >= first)
+						data[i] = std::move(image);
 				} catch (...) {}
 			}
-			next = reader.next_index();
+			next = source_next();
 
-			cv.notify_all();
+			if (next - prev >= slot_cvs.size()) {
+				for (auto &slot: slot_cvs)
+					slot.notify_all();
+			} else {
+				for (std::size_t i = prev; i < next; i++)
+					slot_cv(i).notify_all();
+			}
 		}
 	}
 };
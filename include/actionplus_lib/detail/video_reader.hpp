@@ -8,14 +8,18 @@
 #ifndef ACTIONPLUS_LIB__DETAIL__VIDEO_READER_HPP_
 #define ACTIONPLUS_LIB__DETAIL__VIDEO_READER_HPP_
 
+#include "frame_pool.hpp"
+
 #include <algorithm>
 #include <boost/multi_array.hpp>
 #include <cstddef>
 #include <cstdint>
+#include <deque>
 #include <limits>
 #include <memory>
 #include <string>
-#include <unordered_map>
+#include <utility>
+#include <vector>
 
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -34,10 +38,20 @@ class VideoReader
 public:
 	const std::size_t read_frame_rate = 10;
 
-	// Set scale_height and scale_width to 0 to disable scaling
+	// Set scale_height and scale_width to 0 to disable scaling.
+	// Frames are allocated from pool if given.
+	// With skip_unsampled, non-reference frames that are displayed before the
+	// next sample point are not decoded.
+	// decode_threads is passed to the decoder for frame and slice threading
+	// (0 lets FFmpeg choose).
 	inline VideoReader(const std::string &video,
-		std::size_t scale_height, std::size_t scale_width) :
-	height(scale_height), width(scale_width)
+		std::size_t scale_height, std::size_t scale_width,
+		std::shared_ptr<FramePool> pool = nullptr,
+		bool skip_unsampled = false,
+		unsigned decode_threads = 1) :
+	height(scale_height), width(scale_width),
+	frame_pool(pool ? pool : std::make_shared<FramePool>(1)),
+	sparse(skip_unsampled)
 	{
 		format_ctx = avformat_alloc_context();
 
@@ -106,6 +120,9 @@ public:
 			throw std::runtime_error("avcodec_parameters_to_context failed");
 		}
 
+		codec_ctx->thread_count = decode_threads;
+		codec_ctx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+
 		if (avcodec_open2(codec_ctx, codec, nullptr) < 0) {
 			avcodec_free_context(&codec_ctx);
 			avformat_close_input(&format_ctx);
@@ -145,6 +162,17 @@ public:
 		return tot_frames;
 	}
 
+	// Shape of the frames read, after rotation. 0 if not scaled.
+	inline std::size_t frame_height() const
+	{
+		return (rotation == 90 || rotation == 270) ? width : height;
+	}
+
+	inline std::size_t frame_width() const
+	{
+		return (rotation == 90 || rotation == 270) ? height : width;
+	}
+
 	// thread-unsafe
 	inline std::size_t next_index()
 	{
@@ -164,23 +192,40 @@ public:
 			if (next <= index)
 				throw std::runtime_error("");
 		} catch (...) {
-			for (; next < tot_frames; next++) {
-				data[next] = std::shared_ptr<boost::multi_array<uint8_t, 3>>(
+			while (next < tot_frames) {
+				store(std::shared_ptr<boost::multi_array<uint8_t, 3>>(
 					new boost::multi_array<uint8_t, 3>(
-						boost::extents[1][1][3]));
+						boost::extents[1][1][3])));
 			}
 		}
 
-		auto it = data.find(index);
-		if (it == data.end())
+		if (index < data_begin || index - data_begin >= data.size() ||
+				!data[index - data_begin])
 			throw std::runtime_error("data not found");
-		return it->second;
+		return data[index - data_begin];
+	}
+
+	// thread-unsafe
+	// Same as read() followed by remove(), without copying the pointer
+	inline std::shared_ptr<boost::multi_array<uint8_t, 3>> take(std::size_t index)
+	{
+		read(index);
+		auto image = std::move(data[index - data_begin]);
+		remove(index);
+		return image;
 	}
 
 	// thread-unsafe
 	inline void remove(std::size_t index)
 	{
-		data.erase(index);
+		if (index < data_begin || index - data_begin >= data.size())
+			return;
+
+		data[index - data_begin].reset();
+		while (!data.empty() && !data.front()) {
+			data.pop_front();
+			data_begin++;
+		}
 	}
 
 private:
@@ -200,9 +245,23 @@ private:
 
 	std::size_t tot_frames{0};
 	std::size_t next{0};
+	bool drained{false};
+
+	std::shared_ptr<FramePool> frame_pool;
+	const bool sparse;
 
-	std::unordered_map<std::size_t,
-		std::shared_ptr<boost::multi_array<uint8_t, 3>>> data{};
+	// Scaled frame before rotation
+	std::vector<uint8_t> scaled{};
+
+	// Frames [data_begin, next) that are not removed yet
+	std::size_t data_begin{0};
+	std::deque<std::shared_ptr<boost::multi_array<uint8_t, 3>>> data{};
+
+	inline void store(std::shared_ptr<boost::multi_array<uint8_t, 3>> image)
+	{
+		data.push_back(std::move(image));
+		next++;
+	}
 
 	inline void read_until(std::size_t index)
 	{
@@ -213,148 +272,182 @@ private:
 
 		while (next <= index) {
 			if (av_read_frame(format_ctx, packet) != 0) {
-				// EOF
+				// EOF. Drain the frames the decoder still holds, which are
+				// more with frame threading.
+				if (!drained) {
+					drained = true;
+					if (avcodec_send_packet(codec_ctx, nullptr) >= 0)
+						receive_frames();
+				}
 				return;
 			}
 
 			if (packet->stream_index == stream_idx) {
+				if (sparse)
+					update_skip_frame();
+
 				if (avcodec_send_packet(codec_ctx, packet) < 0) {
 					av_packet_unref(packet);
 					continue;
 				}
 
-				while (true) {
-					int ret = avcodec_receive_frame(codec_ctx, frame);
-					if (ret < 0)
-						break;
-
-					if (next == 0)
-						pts_start = frame->pts;
-
-					if (time_base_to_ms(frame->pts - pts_start) >=
-							next * 1000 / read_frame_rate) {
-						av_frame_apply_cropping(frame, 0);
-
-						if (frame->height == 0 || frame->width == 0) {
-							data[next++] = std::shared_ptr<boost::multi_array<uint8_t, 3>>(
-								new boost::multi_array<uint8_t, 3>(
-									boost::extents[1][1][3]));
-							continue;
-						}
-
-						std::size_t dst_height = height;
-						std::size_t dst_width = width;
-						if (dst_height == 0 || dst_width == 0) {
-							dst_height = frame->height;
-							dst_width = frame->width;
-						}
-						dst_height = std::min(dst_height, static_cast<std::size_t>(
-							std::numeric_limits<int>::max() - 1));
-						dst_width = std::min(dst_width, static_cast<std::size_t>(
-							std::numeric_limits<int>::max() - 1));
-
-						// convert to RGB
-						sws_ctx = sws_getCachedContext(
-							sws_ctx, frame->width, frame->height,
-							static_cast<AVPixelFormat>(frame->format),
-							dst_width, dst_height, AV_PIX_FMT_RGB24,
-							0, nullptr, nullptr, nullptr);
-						if (!sws_ctx)
-							break;
-
-						auto image = std::shared_ptr<boost::multi_array<uint8_t, 3>>(
-							new boost::multi_array<uint8_t, 3>(
-								boost::extents[dst_height][dst_width][3]));
-
-						uint8_t * const dst[1]{image->data()};
-						const int stride[1]{3 * static_cast<int>(dst_width)};
-
-						sws_scale(sws_ctx, frame->data, frame->linesize, 0,
-							frame->height, dst, stride);
-
-						image = rotate(image, rotation);
-
-						data[next++] = std::move(image);
-					}
-				}
+				receive_frames();
 			}
 
 			av_packet_unref(packet);
 		}
 	}
 
-	inline int64_t time_base_to_ms(int64_t time)
+	// Store the sampled frames among the ones the decoder has ready
+	inline void receive_frames()
 	{
-		auto &time_base = format_ctx->streams[stream_idx]->time_base;
-		if (time_base.num == 0)
-			return time;
-		return time * 1000 * time_base.num / time_base.den;
-	}
+		while (true) {
+			int ret = avcodec_receive_frame(codec_ctx, frame);
+			if (ret < 0)
+				break;
 
-	inline std::shared_ptr<boost::multi_array<uint8_t, 3>>
-		rotate(const std::shared_ptr<boost::multi_array<uint8_t, 3>> &image,
-			unsigned degrees)
-	{
-		if (degrees == 270) {
-			return rotate_270(*image);
-		} else if (degrees == 90) {
-			return rotate_90(*image);
-		} else if (degrees == 180) {
-			return rotate_180(*image);
-		} else if (degrees == 0) {
-			return image;
-		} else {
-			return image;
-		}
-	}
+			if (next == 0)
+				pts_start = frame->pts;
 
-	inline std::shared_ptr<boost::multi_array<uint8_t, 3>>
-		rotate_90(const boost::multi_array<uint8_t, 3> &image)
-	{
-		auto rotated = std::shared_ptr<boost::multi_array<uint8_t, 3>>(
-			new boost::multi_array<uint8_t, 3>(boost::extents[image.shape()[1]]
-				[image.shape()[0]][image.shape()[2]]));
+			if (time_base_to_ms(frame->pts - pts_start) >=
+					next * 1000 / read_frame_rate) {
+				av_frame_apply_cropping(frame, 0);
+
+				if (frame->height == 0 || frame->width == 0) {
+					store(std::shared_ptr<boost::multi_array<uint8_t, 3>>(
+						new boost::multi_array<uint8_t, 3>(
+							boost::extents[1][1][3])));
+					continue;
+				}
+
+				std::size_t dst_height = height;
+				std::size_t dst_width = width;
+				if (dst_height == 0 || dst_width == 0) {
+					dst_height = frame->height;
+					dst_width = frame->width;
+				}
+				dst_height = std::min(dst_height, static_cast<std::size_t>(
+					std::numeric_limits<int>::max() - 1));
+				dst_width = std::min(dst_width, static_cast<std::size_t>(
+					std::numeric_limits<int>::max() - 1));
+
+				// convert to RGB
+				sws_ctx = sws_getCachedContext(
+					sws_ctx, frame->width, frame->height,
+					static_cast<AVPixelFormat>(frame->format),
+					dst_width, dst_height, AV_PIX_FMT_RGB24,
+					0, nullptr, nullptr, nullptr);
+				if (!sws_ctx)
+					break;
+
+				std::size_t out_height = dst_height;
+				std::size_t out_width = dst_width;
+				if (rotation == 90 || rotation == 270)
+					std::swap(out_height, out_width);
+
+				auto image = frame_pool->get(out_height, out_width, 3);
+
+				// Without rotation, scale straight into the image.
+				// Otherwise scale into a reused buffer and rotate that
+				// into the image.
+				uint8_t *scale_dst = image->data();
+				if (rotation != 0) {
+					scaled.resize(dst_height * dst_width * 3);
+					scale_dst = scaled.data();
+				}
+
+				uint8_t * const dst[1]{scale_dst};
+				const int stride[1]{3 * static_cast<int>(dst_width)};
+
+				sws_scale(sws_ctx, frame->data, frame->linesize, 0,
+					frame->height, dst, stride);
+
+				if (rotation != 0) {
+					rotate(scaled.data(), dst_height, dst_width,
+						image->data(), rotation);
+				}
 
-		for (std::size_t i = 0; i < image.shape()[1]; i++) {
-			for (std::size_t j = 0; j < image.shape()[0]; j++) {
-				(*rotated)[i][j] = image[image.shape()[0] - j - 1][i];
+				store(std::move(image));
 			}
 		}
-
-		return rotated;
 	}
 
-	inline std::shared_ptr<boost::multi_array<uint8_t, 3>>
-		rotate_180(const boost::multi_array<uint8_t, 3> &image)
+	// A frame displayed before the next sample point is never sampled, so
+	// if nothing depends on it, it does not need to be decoded. Uses the same
+	// comparison as read_until() does for decoded frames.
+	inline void update_skip_frame()
 	{
-		auto rotated = std::shared_ptr<boost::multi_array<uint8_t, 3>>(
-			new boost::multi_array<uint8_t, 3>(boost::extents[image.shape()[0]]
-				[image.shape()[1]][image.shape()[2]]));
-
-		for (std::size_t i = 0; i < image.shape()[0]; i++) {
-			for (std::size_t j = 0; j < image.shape()[1]; j++) {
-				(*rotated)[i][j] =
-					image[image.shape()[0] - i - 1][image.shape()[1] - j - 1];
-			}
-		}
+		AVDiscard skip = AVDISCARD_DEFAULT;
 
-		return rotated;
+		if (next != 0 && packet->pts != AV_NOPTS_VALUE &&
+				time_base_to_ms(packet->pts - pts_start) <
+					static_cast<int64_t>(next * 1000 / read_frame_rate))
+			skip = AVDISCARD_NONREF;
+
+		codec_ctx->skip_frame = skip;
 	}
 
-	inline std::shared_ptr<boost::multi_array<uint8_t, 3>>
-		rotate_270(const boost::multi_array<uint8_t, 3> &image)
+	inline int64_t time_base_to_ms(int64_t time)
 	{
-		auto rotated = std::shared_ptr<boost::multi_array<uint8_t, 3>>(
-			new boost::multi_array<uint8_t, 3>(boost::extents[image.shape()[1]]
-				[image.shape()[0]][image.shape()[2]]));
+		auto &time_base = format_ctx->streams[stream_idx]->time_base;
+		if (time_base.num == 0)
+			return time;
+		return time * 1000 * time_base.num / time_base.den;
+	}
 
-		for (std::size_t i = 0; i < image.shape()[1]; i++) {
-			for (std::size_t j = 0; j < image.shape()[0]; j++) {
-				(*rotated)[i][j] = image[j][image.shape()[1] - i - 1];
+	// Writes the RGB image src of height x width to dst rotated the same way
+	// as the rotate metadata of the stream. For 90 and 270 degrees, dst is
+	// width x height.
+	static inline void rotate(const uint8_t *src, std::size_t height,
+		std::size_t width, uint8_t *dst, unsigned degrees)
+	{
+		if (degrees == 180) {
+			for (std::size_t i = 0; i < height; i++) {
+				const uint8_t *s = src + ((height - i) * width - 1) * 3;
+				uint8_t *d = dst + i * width * 3;
+				for (std::size_t j = 0; j < width; j++, s -= 3, d += 3) {
+					d[0] = s[0];
+					d[1] = s[1];
+					d[2] = s[2];
+				}
 			}
+			return;
 		}
 
-		return rotated;
+		// A destination row is a source column, so go tile by tile to keep
+		// the source rows in cache
+		const std::size_t tile = 32;
+
+		const std::ptrdiff_t row = static_cast<std::ptrdiff_t>(width) * 3;
+
+		for (std::size_t i0 = 0; i0 < width; i0 += tile) {
+			const std::size_t i1 = std::min(i0 + tile, width);
+
+			for (std::size_t j0 = 0; j0 < height; j0 += tile) {
+				const std::size_t j1 = std::min(j0 + tile, height);
+
+				for (std::size_t i = i0; i < i1; i++) {
+					// dst[i][j] is src[height - j - 1][i] for 90 degrees and
+					// src[j][width - i - 1] for 270 degrees
+					const uint8_t *s;
+					std::ptrdiff_t step;
+					if (degrees == 90) {
+						s = src + (height - j0 - 1) * row + i * 3;
+						step = -row;
+					} else {
+						s = src + j0 * row + (width - i - 1) * 3;
+						step = row;
+					}
+
+					uint8_t *d = dst + (i * height + j0) * 3;
+					for (std::size_t j = j0; j < j1; j++, s += step, d += 3) {
+						d[0] = s[0];
+						d[1] = s[1];
+						d[2] = s[2];
+					}
+				}
+			}
+		}
 	}
 };
 
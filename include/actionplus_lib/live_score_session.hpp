@@ -0,0 +1,156 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ *
+ * This Source Code Form is "Incompatible With Secondary Licenses", as
+ * defined by the Mozilla Public License, v. 2.0. */
+
+#ifndef ACTIONPLUS_LIB__LIVE_SCORE_SESSION_HPP_
+#define ACTIONPLUS_LIB__LIVE_SCORE_SESSION_HPP_
+
+#include "action_scores.hpp"
+#include "analysis_snapshot.hpp"
+#include "detail/pose_track.hpp"
+#include "detail/score_matrix.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <libaction/human.hpp>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+
+namespace actionplus_lib
+{
+
+// Scores a video against a standard video while the video is analyzed.
+// Frames are added as they are analyzed, and only the new ones are scored.
+// The means match score() over all frames added so far. Thread-safe.
+class LiveScoreSession
+{
+public:
+	using PairScores = detail::PairScores;
+
+	inline LiveScoreSession(std::shared_ptr<const detail::PoseTrack> standard) :
+	standard_track(std::move(standard))
+	{
+		if (!standard_track)
+			throw std::runtime_error("no standard");
+	}
+
+	LiveScoreSession(const LiveScoreSession &) = delete;
+	LiveScoreSession &operator=(const LiveScoreSession &) = delete;
+
+	// Frames added so far
+	inline std::size_t frames()
+	{
+		std::lock_guard<std::mutex> lk(mtx);
+		return next;
+	}
+
+	// Add frames [frames(), frames() + humans.size()) of the video. Returns
+	// the scores of those of them that the standard video has. If a frame
+	// cannot be scored, throws and adds none of them.
+	inline std::unique_ptr<std::list<PairScores>> append(
+		const std::list<std::unique_ptr<libaction::Human>> &humans)
+	{
+		auto scores = std::unique_ptr<std::list<PairScores>>(
+			new std::list<PairScores>());
+
+		std::lock_guard<std::mutex> lk(mtx);
+		auto frame = next;
+		auto new_sums = sums;
+		for (auto &human: humans)
+			add(human.get(), frame, new_sums, *scores);
+
+		next = frame;
+		sums = std::move(new_sums);
+		return scores;
+	}
+
+	// Add the frames of snapshot from frames() on, which must not be before
+	// snapshot.begin(). Returns their scores like the other append().
+	//
+	// All snapshots must be of the generation of the first one. If the
+	// analysis restarted from frame 0 since, throws, and a new session is
+	// needed.
+	inline std::unique_ptr<std::list<PairScores>> append(
+		const AnalysisSnapshot &snapshot)
+	{
+		auto scores = std::unique_ptr<std::list<PairScores>>(
+			new std::list<PairScores>());
+
+		std::lock_guard<std::mutex> lk(mtx);
+		if (has_generation && snapshot.generation() != generation)
+			throw std::runtime_error("analysis restarted");
+		if (next < snapshot.begin())
+			throw std::runtime_error("frames missing from snapshot");
+
+		auto frame = next;
+		auto new_sums = sums;
+		for (std::size_t i = next; i < snapshot.end(); i++)
+			add(snapshot.human(i), frame, new_sums, *scores);
+
+		next = frame;
+		sums = std::move(new_sums);
+		has_generation = true;
+		generation = snapshot.generation();
+		return scores;
+	}
+
+	inline std::unique_ptr<PairScores> part_means()
+	{
+		std::lock_guard<std::mutex> lk(mtx);
+		return sums.part_means();
+	}
+
+	inline std::uint8_t mean()
+	{
+		std::lock_guard<std::mutex> lk(mtx);
+		return sums.mean();
+	}
+
+private:
+	const std::shared_ptr<const detail::PoseTrack> standard_track;
+
+	std::mutex mtx{};
+	std::size_t next{0};
+
+	// Running sums, as in score()
+	detail::ScoreSums sums{};
+
+	// Of the snapshots added so far
+	bool has_generation{false};
+	std::uint64_t generation{0};
+
+	// Scores the human of frame into frame_sums and advances frame. The
+	// callers commit both once all frames are scored.
+	inline void add(const libaction::Human *human, std::size_t &frame,
+		detail::ScoreSums &frame_sums, std::list<PairScores> &scores) const
+	{
+		if (frame >= standard_track->frames()) {
+			frame++;
+			return;
+		}
+
+		std::unique_ptr<libaction::Human> built;
+		auto standard = standard_track->human(frame, built);
+		if (!human || !standard) {
+			scores.push_back({});
+			frame++;
+			return;
+		}
+
+		auto frame_scores = detail::score_pairs(*human, *standard);
+		frame_sums.add(*frame_scores);
+
+		scores.push_back(std::move(*frame_scores));
+		frame++;
+	}
+};
+
+}
+
+#endif